@@ -7,6 +7,13 @@
 #include <functional>
 #include <utility>
 #include <regex>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 
 /* Initial crate piles parsing */
 typedef char crate;
@@ -93,18 +100,27 @@ struct move {
 
 typedef std::vector<move> moves;
 
-int regex_match_to_int (const std::smatch &match) {
-/* Convert a regex string match to an integer. */
-  return std::stoi(match.str());
+int parse_next_int (const char *&c, const char *end) {
+/* Parse the next unsigned integer in [c, end) and advance c past it. */
+  while (c != end and (*c < '0' or *c > '9')) { c++; }
+  int num = 0;
+  while (c != end and *c >= '0' and *c <= '9') {
+    num = num * 10 + (*c - '0');
+    c++;
+  }
+  return num;
 }
 
 move parse_move (const std::string &line) {
-/* Parse a move string to a move */
+/* Parse a move string to a move.
+ * The format "move N from A to B" is fixed, so we just pick the three
+ * integers in order instead of running a regex over the line. */
   move line_move;
-  auto nums = std::sregex_iterator(line.begin(), line.end(), int_regex);
-  line_move.n = regex_match_to_int(*nums); nums++;
-  line_move.from = regex_match_to_int(*nums); nums++;
-  line_move.to = regex_match_to_int(*nums);
+  const char *c = line.data();
+  const char *end = c + line.size();
+  line_move.n = parse_next_int(c, end);
+  line_move.from = parse_next_int(c, end);
+  line_move.to = parse_next_int(c, end);
   return line_move;
 }
 
@@ -118,6 +134,49 @@ moves parse_moves (std::ifstream &input) {
   return moves_vec;
 }
 
+/* Single-producer single-consumer ring buffer of moves.
+ * Lets a reader thread parse moves while the cranes apply them. */
+class move_ring {
+  public:
+    bool push (const move &_move); // Producer side. false if full.
+    bool pop (move &_move); // Consumer side. false if empty.
+    void close (); // Producer signals there will be no more moves.
+    bool closed () const;
+
+  private:
+    static constexpr std::size_t capacity = 4096; // Power of two.
+    std::array<move, capacity> buf;
+    alignas(64) std::atomic<std::size_t> head {0}; // Next slot to pop.
+    alignas(64) std::atomic<std::size_t> tail {0}; // Next slot to push.
+    alignas(64) std::atomic<bool> done {false};
+};
+
+bool move_ring::push (const move &_move) {
+  std::size_t cur_tail = tail.load(std::memory_order_relaxed);
+  if (cur_tail - head.load(std::memory_order_acquire) == capacity) {
+    return false;
+  }
+  buf[cur_tail & (capacity - 1)] = _move;
+  tail.store(cur_tail + 1, std::memory_order_release);
+  return true;
+}
+
+bool move_ring::pop (move &_move) {
+  std::size_t cur_head = head.load(std::memory_order_relaxed);
+  if (cur_head == tail.load(std::memory_order_acquire)) { return false; }
+  _move = buf[cur_head & (capacity - 1)];
+  head.store(cur_head + 1, std::memory_order_release);
+  return true;
+}
+
+void move_ring::close () {
+  done.store(true, std::memory_order_release);
+}
+
+bool move_ring::closed () const {
+  return done.load(std::memory_order_acquire);
+}
+
 /* Class for managing piles */
 class crane {
   public:
@@ -221,31 +280,282 @@ std::string crane::report_top () {
   return top_crates;
 }
 
+void run_pipelined (std::ifstream &input, crane &crane9000,
+                    crane &crane9001) {
+/* Parse the move lines on a reader thread and apply them to both cranes
+ * as they come, without storing the whole moves vector. */
+  move_ring ring;
+  std::thread reader([&input, &ring]() {
+    std::string line;
+    while (std::getline(input, line)) {
+      move m = parse_move(line);
+      while (not ring.push(m)) { std::this_thread::yield(); }
+    }
+    ring.close();
+  });
+
+  move m;
+  bool finished = false;
+  while (not finished) {
+    // Read the flag before draining: every move pushed before close is
+    // then visible to the pops below.
+    finished = ring.closed();
+    while (ring.pop(m)) {
+      crane9000.do_move(m);
+      crane9001.do_move_9001(m);
+    }
+    if (not finished) { std::this_thread::yield(); }
+  }
+  reader.join();
+}
+
+/* Dependency graph over the moves.
+ * A move only touches its from and to piles, so it only has to wait for
+ * the previous move on each of these piles. Moves on disjoint piles commute
+ * and can run concurrently while giving the same final state. */
+class move_dag {
+  public:
+    moves moves_vec;
+    std::vector<std::array<int, 2>> succ; // Next move on <from, to> pile.
+    std::vector<int> npred; // Number of moves to wait for.
+
+    move_dag (const moves &_moves_vec, int npiles);
+
+    void run_parallel (crane &_crane, bool is_9001, int nthreads);
+};
+
+move_dag::move_dag (const moves &_moves_vec, int npiles) {
+/* Build the graph by remembering the last move seen on each pile. */
+  moves_vec = _moves_vec;
+  int nmoves = moves_vec.size();
+  succ.assign(nmoves, {-1, -1});
+  npred.assign(nmoves, 0);
+  std::vector<std::pair<int, int>> last_on_pile(npiles, {-1, 0});
+  for (int imove = 0; imove < nmoves; imove++) {
+    const move &m = moves_vec[imove];
+    std::array<int, 2> touched = {m.from - 1, m.to - 1};
+    for (int side = 0; side < 2; side++) {
+      int ipile = touched[side];
+      if (side == 1 and ipile == touched[0]) { break; }
+      auto last = last_on_pile.at(ipile);
+      if (last.first != -1) {
+        succ[last.first][last.second] = imove;
+        npred[imove]++;
+      }
+      last_on_pile.at(ipile) = {imove, side};
+    }
+  }
+}
+
+void move_dag::run_parallel (crane &_crane, bool is_9001, int nthreads) {
+/* Apply all the moves to the crane on a pool of worker threads.
+ * Each move is released once all its predecessors are done. A worker keeps
+ * the moves it releases for itself, and only hands them over through the
+ * shared queue while some other worker is idle, waking one per move. */
+  if (nthreads == 1) { // File order already respects every dependency.
+    for (auto &m : moves_vec) {
+      if (is_9001) { _crane.do_move_9001(m); } else { _crane.do_move(m); }
+    }
+    return;
+  }
+  std::vector<std::atomic<int>> waiting(npred.size());
+  std::deque<int> ready;
+  std::mutex mtx;
+  std::condition_variable cv;
+  int remaining = moves_vec.size(); // Settled under mtx.
+  std::atomic<int> nidle(0);
+  for (int imove = 0; imove < int(moves_vec.size()); imove++) {
+    waiting[imove].store(npred[imove], std::memory_order_relaxed);
+    if (npred[imove] == 0) { ready.push_back(imove); }
+  }
+
+  auto worker = [&]() {
+    std::vector<int> own; // Released by this worker, not yet run.
+    int ndone = 0; // Run since this worker last went to the queue.
+    while (true) {
+      if (not own.empty() and nidle.load(std::memory_order_relaxed) > 0) {
+        int shared = own.front(); // Oldest first: the rest stays here.
+        own.erase(own.begin());
+        {
+          std::lock_guard<std::mutex> lock(mtx);
+          ready.push_back(shared);
+        }
+        cv.notify_one();
+      }
+      int imove;
+      if (not own.empty()) {
+        imove = own.back();
+        own.pop_back();
+      } else {
+        std::unique_lock<std::mutex> lock(mtx);
+        remaining -= ndone;
+        if (remaining == 0 and ndone > 0) {
+          cv.notify_all(); // Last moves: let the idle workers leave.
+        }
+        ndone = 0;
+        nidle++;
+        cv.wait(lock, [&]() { return !ready.empty() or remaining == 0; });
+        nidle--;
+        if (ready.empty()) { return; }
+        imove = ready.front();
+        ready.pop_front();
+      }
+      // Moves running concurrently touch disjoint piles.
+      if (is_9001) { _crane.do_move_9001(moves_vec[imove]); }
+      else { _crane.do_move(moves_vec[imove]); }
+      ndone++;
+      for (int next : succ[imove]) {
+        // acq_rel: the last predecessor sees the piles left by the others.
+        if (next != -1 and (npred[next] == 1
+            or waiting[next].fetch_sub(1, std::memory_order_acq_rel) == 1)) {
+          own.push_back(next);
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int ithread = 0; ithread < nthreads; ithread++) {
+    pool.emplace_back(worker);
+  }
+  for (auto &t : pool) { t.join(); }
+}
+
+/* Checkpointed history of the crane states.
+ * The piles are snapshotted every K moves. A pile that did not change
+ * since the previous checkpoint is shared with it, so a checkpoint only
+ * costs the piles touched in the last K moves. */
+typedef std::vector<std::shared_ptr<const pile>> pile_snapshot;
+
+class crane_history {
+  public:
+    moves moves_vec;
+    bool is_9001; // Crane model replayed.
+    int period; // K: number of moves between checkpoints.
+    std::vector<pile_snapshot> checkpoints; // State after i*K moves.
+
+    crane_history (const piles &init_piles, const moves &_moves_vec,
+                   bool _is_9001, int _period);
+
+    piles state_at (int t) const;
+
+  private:
+    void apply (crane &_crane, const move &_move) const;
+};
+
+crane_history::crane_history (const piles &init_piles,
+                              const moves &_moves_vec,
+                              bool _is_9001, int _period) {
+/* Run the crane once over all the moves and record the checkpoints. */
+  moves_vec = _moves_vec;
+  is_9001 = _is_9001;
+  period = std::max(1, _period);
+
+  pile_snapshot snap;
+  for (auto &p : init_piles) { snap.push_back(std::make_shared<pile>(p)); }
+  checkpoints.push_back(snap);
+
+  crane replay(init_piles);
+  std::vector<bool> dirty(init_piles.size(), false);
+  for (int imove = 0; imove < int(moves_vec.size()); imove++) {
+    const move &m = moves_vec[imove];
+    apply(replay, m);
+    dirty.at(m.from - 1) = true;
+    dirty.at(m.to - 1) = true;
+    if ((imove + 1) % period == 0) {
+      for (int ipile = 0; ipile < int(dirty.size()); ipile++) {
+        if (dirty[ipile]) {
+          snap[ipile] = std::make_shared<pile>(replay.crate_piles[ipile]);
+          dirty[ipile] = false;
+        }
+      }
+      checkpoints.push_back(snap);
+    }
+  }
+}
+
+void crane_history::apply (crane &_crane, const move &_move) const {
+  if (is_9001) { _crane.do_move_9001(_move); }
+  else { _crane.do_move(_move); }
+}
+
+piles crane_history::state_at (int t) const {
+/* Piles after the first t moves. Restores the nearest checkpoint at or
+ * before t and replays at most K-1 moves. */
+  t = std::clamp(t, 0, int(moves_vec.size()));
+  int icheck = t / period;
+  piles restored;
+  for (auto &p : checkpoints.at(icheck)) { restored.push_back(*p); }
+  crane replay(restored);
+  for (int imove = icheck * period; imove < t; imove++) {
+    apply(replay, moves_vec[imove]);
+  }
+  return replay.crate_piles;
+}
+
 int main (int argc, char *argv[]) {
   std::cout << "# Day 5 Part 1#" << std::endl;
 
-  if (argc != 2) {
+  if (argc < 2 or argc > 5) {
     std::cerr << "Please provide the input file." << std::endl;
+    std::cerr << "Usage: day5 <input> [--pipelined | --parallel [threads]"
+              << " | --query <t> [K]]" << std::endl;
     return 1;
   }
+  std::string mode = (argc >= 3) ? argv[2] : "";
 
   /* Parsing the input text */
   std::ifstream input(argv[1]);
   piles init_piles = parse_crate_piles(input);
-  moves moves_vec = parse_moves(input);
-  
+
   /* Instantiate the crane */
   crane crane_mover (init_piles);
+  crane crane9001(init_piles);
   std::cout << "Initial piles:\n" << crane_mover.print_piles() << std::endl;
 
-  for (auto m : moves_vec) { crane_mover.do_move(m); }
+  if (mode == "--query") {
+    /* Piles after move t, replayed from the nearest checkpoint. */
+    if (argc < 4) {
+      std::cerr << "Please provide the move index to query." << std::endl;
+      return 1;
+    }
+    int t = std::stoi(argv[3]);
+    int period = (argc == 5) ? std::stoi(argv[4]) : 1000;
+    moves moves_vec = parse_moves(input);
+    crane_history history(init_piles, moves_vec, false, period);
+    crane_history history9001(init_piles, moves_vec, true, period);
+    crane at_t(history.state_at(t));
+    crane at_t9001(history9001.state_at(t));
+    std::cout << "Piles after move " << t << ":\n" << at_t.print_piles()
+              << std::endl;
+    std::cout << "Piles after move " << t << " (9001):\n"
+              << at_t9001.print_piles() << std::endl;
+    return 0;
+  }
+
+  if (mode == "--pipelined") {
+    run_pipelined(input, crane_mover, crane9001);
+  } else if (mode == "--parallel") {
+    moves moves_vec = parse_moves(input);
+    move_dag dag(moves_vec, init_piles.size());
+    int nthreads = (argc >= 4) ? std::stoi(argv[3])
+                   : std::max(1u, std::thread::hardware_concurrency());
+    if (nthreads < 1) {
+      std::cerr << "The thread count must be positive." << std::endl;
+      return 1;
+    }
+    dag.run_parallel(crane_mover, false, nthreads);
+    dag.run_parallel(crane9001, true, nthreads);
+  } else {
+    moves moves_vec = parse_moves(input);
+    for (auto m : moves_vec) { crane_mover.do_move(m); }
+    for (auto m : moves_vec) { crane9001.do_move_9001(m); }
+  }
 
   std::cout << "Final piles:\n" << crane_mover.print_piles() << std::endl;
   std::cout << "Top crates: " << crane_mover.report_top() << std::endl;
 
   std::cout << "# Part 2 #" << std::endl;
-  crane crane9001(init_piles);
-  for (auto m : moves_vec) { crane9001.do_move_9001(m); }
   std::cout << "Final piles:\n" << crane9001.print_piles() << std::endl;
   std::cout << "Top crates: " << crane9001.report_top() << std::endl;
 }
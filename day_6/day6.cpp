@@ -6,61 +6,354 @@
 #include <numeric>
 #include <functional>
 #include <utility>
-#include <regex>
-#include <deque>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <climits>
+#include <cstring>
 
-bool buffer_ismarker (const std::deque<char> &buf) {
-/* Check whether the buffer has non-repeating characters */
-  auto test_buf(buf);
-  std::sort(test_buf.begin(), test_buf.end());
-  auto dups = std::unique(test_buf.begin(), test_buf.end());
-  test_buf.erase(dups, test_buf.end());
-  return (test_buf.size() == buf.size());
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Sliding window of distinct bytes */
+class window_detector {
+/* Keeps the longest run of distinct bytes ending at the last byte fed,
+ * capped at k bytes, with a count per byte value. When a byte repeats,
+ * the window jumps past its previous occurrence at once: no window
+ * containing both copies can be a marker. O(1) amortized per byte. */
+  public:
+    window_detector (int _k);
+    bool push (char c); // Feed a byte. true if the last k bytes are distinct.
+
+  private:
+    int k;
+    std::vector<unsigned char> ring; // Current run, at most k bytes.
+    int run_start = 0; // Ring index of the oldest byte of the run.
+    int run_size = 0;
+    std::array<int, 256> counts {}; // Count of each byte value in the run.
+
+    void pop_front ();
+};
+
+window_detector::window_detector (int _k) {
+  k = _k;
+  ring.resize(std::max(1, k));
 }
 
-int find_marker (const std::string &input_line) {
-/* Find the first sequence of 4 characters without repetition. */
-  char first_char = input_line.front();
-  std::deque<char> buf = {first_char, first_char, first_char, first_char};
-  int marker_pos = 0;
-  for (char c : input_line) {
-    buf.push_back(c);
-    buf.pop_front();
-    marker_pos++;
-    if (buffer_ismarker(buf)) { return marker_pos; }
+void window_detector::pop_front () {
+  counts[ring[run_start]]--;
+  if (++run_start == k) { run_start = 0; }
+  run_size--;
+}
+
+bool window_detector::push (char c) {
+  auto byte = static_cast<unsigned char>(c);
+  if (run_size == k) { pop_front(); }
+  while (counts[byte] > 0) { pop_front(); } // Skip past the duplicate.
+  int slot = run_start + run_size;
+  if (slot >= k) { slot -= k; }
+  ring[slot] = byte;
+  counts[byte]++;
+  run_size++;
+  return run_size == k;
+}
+
+long long find_distinct_window (const char *begin, const char *end, int k) {
+/* Find the first window of k distinct bytes in [begin, end).
+ * Return the number of bytes read up to the end of the window,
+ * -1 if there is none. */
+  if (k <= 0) { return 0; }
+  if (k > 256) { return -1; } // Cannot have more than 256 distinct bytes.
+  window_detector detector(k);
+  for (const char *c = begin; c != end; c++) {
+    if (detector.push(*c)) { return (c - begin) + 1; }
   }
-  return marker_pos;
+  return -1;
+}
+
+long long find_distinct_window (const std::string &input_line, int k) {
+  return find_distinct_window(input_line.data(),
+                              input_line.data() + input_line.size(), k);
 }
 
-bool buffer_ismessage(const std::deque<char> &buf) {
-/* Check whether the buffer is a message */
-  auto test_buf(buf);
-  std::sort(test_buf.begin(), test_buf.end());
-  auto dups = std::unique(test_buf.begin(), test_buf.end());
-  test_buf.erase(dups, test_buf.end());
-  return (test_buf.size() == buf.size());
+long long find_marker (const std::string &input_line) {
+/* Find the first sequence of 4 characters without repetition. */
+  return find_distinct_window(input_line, 4);
 }
 
-int find_message (const std::string &input_line) {
+long long find_message (const std::string &input_line) {
 /* Find the first message (14 characters non-repeating). */
-  char first_char = input_line.front();
-  std::deque<char> buf;
-  for (auto i=0;i<14;i++) {buf.push_back(first_char);}
-  int message_pos = 0;
-  for (char c : input_line) {
-    buf.push_back(c);
-    buf.pop_front();
-    message_pos++;
-    if (buffer_ismessage(buf)) { return message_pos; }
+  return find_distinct_window(input_line, 14);
+}
+
+long long parallel_find_distinct_window (const char *begin, const char *end,
+                                         int k, int nthreads) {
+/* Same result as find_distinct_window, searched on several threads.
+ * The buffer is cut in chunks handed out in order. Each chunk is searched
+ * from k-1 bytes before its start, so a window ending in the chunk is
+ * always seen whole. The earliest hit wins: chunks starting after an
+ * already found window are not searched. */
+  if (k <= 0) { return 0; }
+  if (k > 256) { return -1; }
+  long long len = end - begin;
+  long long chunk_len = std::max<long long>(1 << 20, len / (4 * nthreads) + 1);
+  long long nchunks = (len + chunk_len - 1) / chunk_len;
+  std::atomic<long long> next_chunk {0};
+  std::atomic<long long> best {LLONG_MAX};
+
+  auto worker = [&]() {
+    while (true) {
+      long long ichunk = next_chunk.fetch_add(1);
+      if (ichunk >= nchunks) { return; }
+      long long chunk_start = ichunk * chunk_len;
+      if (chunk_start >= best.load()) { return; } // Later chunks lose.
+      long long chunk_end = std::min(len, chunk_start + chunk_len);
+      long long search_start = std::max(0LL, chunk_start - (k - 1));
+      long long found = find_distinct_window(begin + search_start,
+                                             begin + chunk_end, k);
+      if (found == -1) { continue; }
+      long long pos = search_start + found;
+      long long cur_best = best.load();
+      while (pos < cur_best and
+             not best.compare_exchange_weak(cur_best, pos)) {}
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int ithread = 0; ithread < nthreads; ithread++) {
+    pool.emplace_back(worker);
+  }
+  for (auto &t : pool) { t.join(); }
+  return (best.load() == LLONG_MAX) ? -1 : best.load();
+}
+
+/* Several window sizes at once */
+class multi_window_scanner {
+/* Tracks the length of the run of distinct bytes ending at the current
+ * byte with a last-seen position per byte value. The run grows by at most
+ * one byte per step, so the first time it reaches k is the first window
+ * of k distinct bytes. All the requested sizes are answered in one sweep,
+ * from the smallest to the largest. */
+  public:
+    std::vector<long long> positions; // Per requested size. -1 if not found.
+
+    multi_window_scanner (const std::vector<int> &_sizes);
+    bool feed (const char *begin, const char *end); // true once all found.
+    bool done () const;
+
+  private:
+    std::vector<int> sizes;
+    std::vector<int> pending; // Indices of sizes to find, increasing size.
+    std::size_t next_pending = 0;
+    std::array<long long, 256> last_seen;
+    long long pos = 0; // Number of bytes fed so far.
+    long long run_start = 0; // Position of the first byte of the run.
+};
+
+multi_window_scanner::multi_window_scanner (const std::vector<int> &_sizes) {
+  sizes = _sizes;
+  positions.assign(sizes.size(), -1);
+  last_seen.fill(-1);
+  for (int isize = 0; isize < int(sizes.size()); isize++) {
+    if (sizes[isize] <= 0) { positions[isize] = 0; }
+    else if (sizes[isize] <= 256) { pending.push_back(isize); }
+    // Larger sizes can never be made of distinct bytes.
   }
-  return message_pos;
+  std::sort(pending.begin(), pending.end(),
+            [this](int a, int b) { return sizes[a] < sizes[b]; });
+}
+
+bool multi_window_scanner::done () const {
+  return next_pending == pending.size();
+}
+
+bool multi_window_scanner::feed (const char *begin, const char *end) {
+/* Feed the next bytes of the datastream. */
+  for (const char *c = begin; c != end and not done(); c++) {
+    auto byte = static_cast<unsigned char>(*c);
+    if (last_seen[byte] >= run_start) { run_start = last_seen[byte] + 1; }
+    last_seen[byte] = pos;
+    pos++;
+    long long run_len = pos - run_start;
+    while (not done() and sizes[pending[next_pending]] <= run_len) {
+      positions[pending[next_pending]] = pos;
+      next_pending++;
+    }
+  }
+  return done();
+}
+
+std::vector<long long> find_distinct_windows (const std::string &input_line,
+                                              const std::vector<int> &sizes) {
+/* First window of distinct characters for each of the sizes. */
+  multi_window_scanner scanner(sizes);
+  scanner.feed(input_line.data(), input_line.data() + input_line.size());
+  return scanner.positions;
+}
+
+std::vector<int> parse_sizes (const std::string &sizes_str) {
+/* Parse a comma-separated list of window sizes. */
+  std::vector<int> sizes;
+  std::string::size_type start = 0;
+  while (start < sizes_str.size()) {
+    auto delim_pos = sizes_str.find(',', start);
+    if (delim_pos == std::string::npos) { delim_pos = sizes_str.size(); }
+    sizes.push_back(std::stoi(sizes_str.substr(start, delim_pos - start)));
+    start = delim_pos + 1;
+  }
+  return sizes;
+}
+
+/* Streaming search */
+int stream_markers (int fd, const std::vector<int> &sizes) {
+/* Read the datastream from fd in fixed-size chunks and print the position
+ * of each window size as soon as it is found. Memory stays constant: the
+ * scanner only keeps one last-seen position per byte value. The datastream
+ * ends at the first newline or at end of input. */
+  multi_window_scanner scanner(sizes);
+  std::vector<bool> reported(sizes.size(), false);
+  std::array<char, 1 << 16> chunk;
+  bool end_of_line = false;
+  while (not scanner.done() and not end_of_line) {
+    ssize_t nread = read(fd, chunk.data(), chunk.size());
+    if (nread < 0) {
+      std::cerr << "Error reading the datastream." << std::endl;
+      return 1;
+    }
+    if (nread == 0) { break; }
+    const char *begin = chunk.data();
+    const char *end = begin + nread;
+    const char *newline = std::find(begin, end, '\n');
+    end_of_line = (newline != end);
+    scanner.feed(begin, newline);
+    for (int isize = 0; isize < int(sizes.size()); isize++) {
+      if (not reported[isize] and scanner.positions[isize] != -1) {
+        reported[isize] = true;
+        std::cout << "Window " << sizes[isize] << " position: "
+                  << scanner.positions[isize] << std::endl;
+      }
+    }
+  }
+  for (int isize = 0; isize < int(sizes.size()); isize++) {
+    if (not reported[isize]) {
+      std::cout << "Window " << sizes[isize] << " position: -1" << std::endl;
+    }
+  }
+  return 0;
+}
+
+/* Batch mode: one datastream per line */
+std::vector<std::pair<long long, long long>> index_lines (const char *begin,
+                                                          const char *end) {
+/* <start, end> offsets of every line in the buffer, newlines excluded. */
+  std::vector<std::pair<long long, long long>> lines;
+  const char *line_start = begin;
+  while (line_start < end) {
+    const char *newline = static_cast<const char *>(
+      std::memchr(line_start, '\n', end - line_start));
+    const char *line_end = newline ? newline : end;
+    lines.push_back({line_start - begin, line_end - begin});
+    line_start = line_end + 1;
+  }
+  return lines;
+}
+
+int batch_markers (const std::string &input_path,
+                   const std::string &output_path) {
+/* Compute the marker and message positions of every line of the input
+ * file on a thread pool. The results are written in columns:
+ *   int64 number of lines, int64 markers[n], int64 messages[n]. */
+  int fd = open(input_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Cannot open " << input_path << std::endl;
+    return 1;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  long long file_size = st.st_size;
+  const char *data = nullptr;
+  if (file_size > 0) {
+    void *map = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      std::cerr << "Cannot map " << input_path << std::endl;
+      close(fd);
+      return 1;
+    }
+    data = static_cast<const char *>(map);
+  }
+  close(fd);
+
+  auto lines = index_lines(data, data + file_size);
+  long long nlines = lines.size();
+  std::vector<long long> markers(nlines), messages(nlines);
+
+  const long long block = 1024; // Lines handed to a thread at a time.
+  std::atomic<long long> next_line {0};
+  auto worker = [&]() {
+    while (true) {
+      long long first = next_line.fetch_add(block);
+      if (first >= nlines) { return; }
+      long long last = std::min(nlines, first + block);
+      for (long long iline = first; iline < last; iline++) {
+        const char *line_begin = data + lines[iline].first;
+        const char *line_end = data + lines[iline].second;
+        markers[iline] = find_distinct_window(line_begin, line_end, 4);
+        messages[iline] = find_distinct_window(line_begin, line_end, 14);
+      }
+    }
+  };
+  int nthreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> pool;
+  for (int ithread = 0; ithread < nthreads; ithread++) {
+    pool.emplace_back(worker);
+  }
+  for (auto &t : pool) { t.join(); }
+  if (data) { munmap(const_cast<char *>(data), file_size); }
+
+  std::ofstream output(output_path, std::ios::binary);
+  output.write(reinterpret_cast<const char *>(&nlines), sizeof(nlines));
+  output.write(reinterpret_cast<const char *>(markers.data()),
+               nlines * sizeof(long long));
+  output.write(reinterpret_cast<const char *>(messages.data()),
+               nlines * sizeof(long long));
+  if (not output) {
+    std::cerr << "Cannot write " << output_path << std::endl;
+    return 1;
+  }
+  std::cout << "Datastreams processed: " << nlines << std::endl;
+  return 0;
 }
 
 int main (int argc, char *argv[]) {
   std::cout << "# Day 6 Part 1#" << std::endl;
 
-  if (argc != 2) {
+  if (argc >= 3 and std::string(argv[1]) == "--stream") {
+    /* Streaming mode: the input may be a pipe, "-" for stdin. */
+    std::string path = argv[2];
+    int fd = (path == "-") ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Cannot open " << path << std::endl;
+      return 1;
+    }
+    auto sizes = (argc == 4) ? parse_sizes(argv[3]) : std::vector<int>{4, 14};
+    int status = stream_markers(fd, sizes);
+    if (fd != STDIN_FILENO) { close(fd); }
+    return status;
+  }
+
+  if (argc == 4 and std::string(argv[1]) == "--batch") {
+    /* Batch mode: every line of the input is a datastream. */
+    return batch_markers(argv[2], argv[3]);
+  }
+
+  if (argc < 2 or argc > 4) {
     std::cerr << "Please provide the input file." << std::endl;
+    std::cerr << "Usage: day6 <input> [--sizes k1,k2,... | --parallel]"
+              << std::endl;
+    std::cerr << "       day6 --stream <input | -> [k1,k2,...]" << std::endl;
+    std::cerr << "       day6 --batch <input> <output>" << std::endl;
     return 1;
   }
 
@@ -69,13 +362,33 @@ int main (int argc, char *argv[]) {
   std::string input_line;
   std::getline(input, input_line);
 
-  /* Finding first marker */
-  int marker_pos = find_marker(input_line);
+  long long marker_pos, message_pos;
+  if (argc == 3 and std::string(argv[2]) == "--parallel") {
+    /* Splitting the search across threads */
+    int nthreads = std::max(1u, std::thread::hardware_concurrency());
+    const char *begin = input_line.data();
+    const char *end = begin + input_line.size();
+    marker_pos = parallel_find_distinct_window(begin, end, 4, nthreads);
+    message_pos = parallel_find_distinct_window(begin, end, 14, nthreads);
+  } else {
+    /* Finding first marker */
+    marker_pos = find_marker(input_line);
 
-  /* Finding first message */
-  int message_pos = find_message(input_line);
+    /* Finding first message */
+    message_pos = find_message(input_line);
+  }
  
   std::cout << "Input length: " << input_line.size() << std::endl;
   std::cout << "Marker position: " << marker_pos << std::endl;
   std::cout << "Message position: " << message_pos << std::endl;
+
+  /* Other window sizes, all in one pass */
+  if (argc == 4 and std::string(argv[2]) == "--sizes") {
+    auto sizes = parse_sizes(argv[3]);
+    auto positions = find_distinct_windows(input_line, sizes);
+    for (int isize = 0; isize < int(sizes.size()); isize++) {
+      std::cout << "Window " << sizes[isize] << " position: "
+                << positions[isize] << std::endl;
+    }
+  }
 }
@@ -6,6 +6,25 @@
 #include <numeric>
 #include <functional>
 #include <utility>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <chrono>
+#include <set>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <memory>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/graph_traits.hpp>
@@ -14,7 +33,7 @@
 /* Graph */
 struct VertexProperty {
   bool is_file; // true for files (leaf nodes), false for folders.
-  int size = 0; // File size
+  long long size = 0; // File size
   std::string name; // File or folder names.
 };
 
@@ -62,12 +81,12 @@ std::string parse_dir_name (const std::string &line) {
   return line.substr(4);
 }
 
-std::pair<int, std::string> parse_filedata (const std::string &line) {
+std::pair<long long, std::string> parse_filedata (const std::string &line) {
 /* Parse the filesize and filename of the file in line */
-  std::pair<int, std::string> filedata;
+  std::pair<long long, std::string> filedata;
   std::string::size_type delim_pos = line.find_first_of(' ');
   std::string filesize_str = line.substr(0, delim_pos);
-  int filesize = std::stoi(filesize_str);
+  long long filesize = std::stoll(filesize_str);
   std::string filename = line.substr(delim_pos + 1);
   filedata.first = filesize;
   filedata.second = filename;
@@ -82,7 +101,7 @@ class graph_builder {
     graph_builder ();
     void cd_toparent ();
     void cd_tochild (const std::string &name);
-    void add_file (const std::string name, const int size);
+    void add_file (const std::string name, const long long size);
     void add_dir (const std::string name);
 
     void parse_cd_line (const std::string &line);
@@ -116,7 +135,8 @@ void graph_builder::cd_tochild (const std::string &name) {
   cur_dir = target(*find_res, g);
 }
 
-void graph_builder::add_file (const std::string name, const int size) {
+void graph_builder::add_file (const std::string name,
+                              const long long size) {
 /* Add a file in the current directory. */
   vertex_desc file = add_vertex(g);
   g[file].is_file = true;
@@ -152,7 +172,7 @@ void graph_builder::parse_output_line (const std::string &line) {
   }
   else if (output_is_file(line)) {
     auto file_data = parse_filedata(line);
-    int filesize = file_data.first;
+    long long filesize = file_data.first;
     std::string filename = file_data.second;
     graph_builder::add_file(filename, filesize);
   }
@@ -197,8 +217,8 @@ void graph_sizes::compute_contents_size (const vertex_desc &folder) {
 /* Compute the size of the current folder's contents. */
   typename GraphTraits::out_edge_iterator out_i, out_end; 
   boost::tie(out_i, out_end) = out_edges(folder, g);
-  int size = std::accumulate(out_i, out_end, 0,
-    [this](int cur_sum, GraphTraits::edge_descriptor e)
+  long long size = std::accumulate(out_i, out_end, 0LL,
+    [this](long long cur_sum, GraphTraits::edge_descriptor e)
           {return cur_sum + g[target(e, g)].size;});
   g[folder].size = size;
 }
@@ -210,28 +230,896 @@ void graph_sizes::compute_dirs_size () {
   }
 }
 
-int main (int argc, char *argv[]) {
-  std::cout << "# Day 7#" << std::endl;
+/* Flat directory tree
+ * All the nodes live in one vector and refer to each other by index. Names
+ * are interned once in a single string pool. Directory sizes are summed
+ * while parsing: a directory hands its size to its parent when we leave
+ * it, so no topological sort is needed afterwards. */
+struct tree_node {
+  int parent = -1; // -1 for the root.
+  int first_child = -1;
+  int next_sibling = -1;
+  int name_id = 0; // Index of the name in the tree name pool.
+  bool is_file = false;
+  long long size = 0; // File size, or total size of a folder's contents.
+  long long reported = 0; // Part of the folder size already in the parent.
+};
 
-  if (argc != 2) {
-    std::cerr << "Please provide the input file." << std::endl;
-    return 1;
+/* Hash index of the children of every folder.
+ * Open addressing with linear probing, keyed by the pair
+ * (parent node, child name id), so cd into a child is O(1) on average
+ * whatever the number of entries in the folder. */
+class child_index {
+  public:
+    child_index ();
+    void insert (int parent, int name_id, int child);
+    int find (int parent, int name_id) const; // -1 if not found.
+
+  private:
+    struct slot {
+      std::uint64_t key = 0;
+      int child = -1; // -1 for an empty slot.
+    };
+    std::vector<slot> slots; // Size is a power of two.
+    std::size_t nused = 0;
+
+    static std::uint64_t make_key (int parent, int name_id);
+    std::size_t home (std::uint64_t key) const;
+    void grow ();
+};
+
+child_index::child_index () {
+  slots.resize(16);
+}
+
+std::uint64_t child_index::make_key (int parent, int name_id) {
+  return (std::uint64_t(std::uint32_t(parent)) << 32)
+         | std::uint32_t(name_id);
+}
+
+std::size_t child_index::home (std::uint64_t key) const {
+/* Fibonacci hashing of the key to a slot. */
+  std::uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+  return (h ^ (h >> 32)) & (slots.size() - 1);
+}
+
+void child_index::grow () {
+/* Double the table and reinsert every entry. */
+  std::vector<slot> old_slots(slots.size() * 2);
+  old_slots.swap(slots);
+  for (auto &s : old_slots) {
+    if (s.child == -1) { continue; }
+    std::size_t i = home(s.key);
+    while (slots[i].child != -1) { i = (i + 1) & (slots.size() - 1); }
+    slots[i] = s;
   }
+}
 
-  /* Part 1 solution outline
- *   * Parse all folders and files into the graph.
- *     * Detect the type and subtype of lines: input line (cd or ls),
- *       output line (dir or file).
- *   * Perform a topological sort of the directories in the graph.
- *     Iterate from the bottom to the top, compute the size of
- *     the directory's contents each time.
- *   * Iterate over folder nodes and accumulate the size of those
- *     with size at most X. */
+void child_index::insert (int parent, int name_id, int child) {
+  if (2 * (nused + 1) > slots.size()) { grow(); } // Load factor <= 1/2.
+  std::uint64_t key = make_key(parent, name_id);
+  std::size_t i = home(key);
+  while (slots[i].child != -1) {
+    if (slots[i].key == key) { slots[i].child = child; return; }
+    i = (i + 1) & (slots.size() - 1);
+  }
+  slots[i].key = key;
+  slots[i].child = child;
+  nused++;
+}
+
+int child_index::find (int parent, int name_id) const {
+  std::uint64_t key = make_key(parent, name_id);
+  std::size_t i = home(key);
+  while (slots[i].child != -1) {
+    if (slots[i].key == key) { return slots[i].child; }
+    i = (i + 1) & (slots.size() - 1);
+  }
+  return -1;
+}
+
+/* Hash index of the interned names.
+ * Open addressing with linear probing over name ids. Slots keep the hash
+ * of their name, and names are compared against their slice of the pool,
+ * so no name is stored twice. */
+class name_index {
+  public:
+    name_index ();
+    // Id of the name in the pool delimited by starts, -1 if not found.
+    int find (const std::string &name, const std::string &pool,
+              const std::vector<int> &starts) const;
+    void insert (const std::string &name, int id);
+
+  private:
+    struct slot {
+      std::uint32_t hash = 0;
+      int id = -1; // -1 for an empty slot.
+    };
+    std::vector<slot> slots; // Size is a power of two.
+    std::size_t nused = 0;
+
+    static std::uint32_t hash_name (const std::string &name);
+    std::size_t home (std::uint32_t hash) const;
+    void grow ();
+};
+
+name_index::name_index () {
+  slots.resize(16);
+}
+
+std::uint32_t name_index::hash_name (const std::string &name) {
+/* FNV-1a hash of the name, folded to 32 bits. */
+  std::uint64_t h = 0xCBF29CE484222325ULL;
+  for (unsigned char c : name) {
+    h = (h ^ c) * 0x100000001B3ULL;
+  }
+  return h ^ (h >> 32);
+}
+
+std::size_t name_index::home (std::uint32_t hash) const {
+/* Fibonacci hashing of the name hash to a slot. */
+  std::uint64_t h = hash * 0x9E3779B97F4A7C15ULL;
+  return (h ^ (h >> 32)) & (slots.size() - 1);
+}
+
+void name_index::grow () {
+/* Double the table and reinsert every entry, from the kept hashes. */
+  std::vector<slot> old_slots(slots.size() * 2);
+  old_slots.swap(slots);
+  for (auto &s : old_slots) {
+    if (s.id == -1) { continue; }
+    std::size_t i = home(s.hash);
+    while (slots[i].id != -1) { i = (i + 1) & (slots.size() - 1); }
+    slots[i] = s;
+  }
+}
+
+void name_index::insert (const std::string &name, int id) {
+/* Add a name known to be absent. */
+  if (2 * (nused + 1) > slots.size()) { grow(); } // Load factor <= 1/2.
+  std::uint32_t hash = hash_name(name);
+  std::size_t i = home(hash);
+  while (slots[i].id != -1) { i = (i + 1) & (slots.size() - 1); }
+  slots[i].hash = hash;
+  slots[i].id = id;
+  nused++;
+}
+
+int name_index::find (const std::string &name, const std::string &pool,
+                      const std::vector<int> &starts) const {
+  std::uint32_t hash = hash_name(name);
+  std::size_t i = home(hash);
+  while (slots[i].id != -1) {
+    int id = slots[i].id;
+    if (slots[i].hash == hash
+        and std::size_t(starts[id + 1] - starts[id]) == name.size()
+        and pool.compare(starts[id], name.size(), name) == 0) {
+      return id;
+    }
+    i = (i + 1) & (slots.size() - 1);
+  }
+  return -1;
+}
+
+class dir_tree {
+  public:
+    std::vector<tree_node> nodes; // nodes[0] is the root folder.
+    std::string name_pool; // All distinct names, concatenated.
+    std::vector<int> name_starts; // Offset of each name in the pool.
+    int cur_dir = 0;
+
+    dir_tree ();
+    int intern (const std::string &name);
+    std::string name (int inode) const;
+
+    void cd_toparent ();
+    void cd_toroot ();
+    void cd_tochild (const std::string &name);
+    int find_child (int dir, const std::string &name) const;
+    int add_node (const std::string &name, bool is_file, long long size);
+    void add_file (const std::string &name, const long long size);
+    void add_dir (const std::string &name);
+
+    void process_line (const std::string &line);
+    void finish (); // Report the sizes of the folders still open.
+
+  private:
+    name_index name_ids;
+    child_index children;
+    void report_size (int dir);
+};
+
+dir_tree::dir_tree () {
+  name_starts.push_back(0);
+  tree_node root;
+  root.name_id = intern("/");
+  nodes.push_back(root);
+}
+
+int dir_tree::intern (const std::string &name) {
+/* Return the id of the name, adding it to the pool if it is new. */
+  int found = name_ids.find(name, name_pool, name_starts);
+  if (found != -1) { return found; }
+  int id = name_starts.size() - 1;
+  name_pool += name;
+  name_starts.push_back(name_pool.size());
+  name_ids.insert(name, id);
+  return id;
+}
+
+std::string dir_tree::name (int inode) const {
+  int id = nodes.at(inode).name_id;
+  return name_pool.substr(name_starts[id],
+                          name_starts[id + 1] - name_starts[id]);
+}
 
-  /* Parsing the input text */
+void dir_tree::report_size (int dir) {
+/* Pass the size accumulated by dir since the last report to its parent. */
+  tree_node &node = nodes[dir];
+  if (node.parent == -1) { return; }
+  nodes[node.parent].size += node.size - node.reported;
+  node.reported = node.size;
+}
+
+void dir_tree::cd_toparent () {
+  report_size(cur_dir);
+  if (nodes[cur_dir].parent != -1) { cur_dir = nodes[cur_dir].parent; }
+}
+
+void dir_tree::cd_toroot () {
+  while (cur_dir != 0) { cd_toparent(); }
+}
+
+void dir_tree::cd_tochild (const std::string &name) {
+/* Move to the child directory with given name. */
+  int child = find_child(cur_dir, name);
+  if (child == -1 or nodes[child].is_file) {
+    std::cerr << "Directory not found: " << name << std::endl;
+    return;
+  }
+  cur_dir = child;
+}
+
+int dir_tree::find_child (int dir, const std::string &name) const {
+/* Node of the child of dir with given name. -1 if there is none. */
+  int name_id = name_ids.find(name, name_pool, name_starts);
+  if (name_id == -1) { return -1; }
+  return children.find(dir, name_id);
+}
+
+int dir_tree::add_node (const std::string &name, bool is_file,
+                        long long size) {
+/* Add a node as the first child of the current directory. */
+  tree_node node;
+  node.parent = cur_dir;
+  node.next_sibling = nodes[cur_dir].first_child;
+  node.name_id = intern(name);
+  node.is_file = is_file;
+  node.size = size;
+  int inode = nodes.size();
+  nodes.push_back(node);
+  nodes[cur_dir].first_child = inode;
+  children.insert(cur_dir, node.name_id, inode);
+  return inode;
+}
+
+void dir_tree::add_file (const std::string &name, const long long size) {
+  add_node(name, true, size);
+  nodes[cur_dir].size += size;
+}
+
+void dir_tree::add_dir (const std::string &name) {
+  add_node(name, false, 0);
+}
+
+void dir_tree::process_line (const std::string &line) {
+/* Process one input line */
+  if (line.empty()) { return; }
+  if (is_input(line)) {
+    if (input_is_ls(line)) { return; }
+    std::string cd_name = parse_cd_target(line);
+    if (cd_name == "..") { cd_toparent(); }
+    else if (cd_name == "/") { cd_toroot(); }
+    else { cd_tochild(cd_name); }
+  }
+  else if (output_is_dir(line)) { add_dir(parse_dir_name(line)); }
+  else {
+    auto file_data = parse_filedata(line);
+    add_file(file_data.second, file_data.first);
+  }
+}
+
+void dir_tree::finish () {
+  cd_toroot();
+}
+
+/* Parallel folder sizes
+ * Post-order sum of the file sizes over the tree, on a pool of threads.
+ * Visiting a folder pushes its subfolders on the thread's own deque. An
+ * idle thread steals from the front of another deque, which holds the
+ * oldest, hence biggest, subtrees. A folder is complete once its files and
+ * all of its subfolders are summed: the last of these steps hands its
+ * size up to the parent. */
+struct work_deque {
+  std::mutex mtx;
+  std::deque<int> tasks;
+};
+
+void compute_sizes_parallel (dir_tree &tree, int nthreads) {
+/* Recompute the size of every folder from the file sizes. */
+  int nnodes = tree.nodes.size();
+  std::vector<std::atomic<int>> pending(nnodes); // Steps left per folder.
+  std::vector<std::atomic<long long>> partial(nnodes); // Sum so far.
+  for (int inode = 0; inode < nnodes; inode++) {
+    pending[inode].store(1); // The folder's own files.
+    partial[inode].store(0);
+  }
+  std::atomic<int> remaining {0}; // Folders not yet complete.
+  for (auto &node : tree.nodes) {
+    if (node.is_file) { continue; }
+    remaining++;
+    if (node.parent != -1) { pending[node.parent]++; }
+  }
+
+  std::vector<work_deque> deques(nthreads);
+  deques[0].tasks.push_back(0);
+
+  auto complete = [&](int dir) {
+  /* One step of dir is done. Finish it and its parents if it was the
+   * last one. */
+    while (dir != -1 and --pending[dir] == 0) {
+      tree_node &node = tree.nodes[dir];
+      node.size = partial[dir].load();
+      if (node.parent != -1) {
+        node.reported = node.size;
+        partial[node.parent] += node.size;
+      }
+      remaining--;
+      dir = node.parent;
+    }
+  };
+
+  auto visit = [&](int dir, work_deque &own) {
+    long long files_size = 0;
+    for (int child = tree.nodes[dir].first_child; child != -1;
+         child = tree.nodes[child].next_sibling) {
+      if (tree.nodes[child].is_file) {
+        files_size += tree.nodes[child].size;
+      } else {
+        std::lock_guard<std::mutex> lock(own.mtx);
+        own.tasks.push_back(child);
+      }
+    }
+    partial[dir] += files_size;
+    complete(dir);
+  };
+
+  auto worker = [&](int ithread) {
+    work_deque &own = deques[ithread];
+    while (remaining.load() > 0) {
+      int dir = -1;
+      {
+        std::lock_guard<std::mutex> lock(own.mtx);
+        if (not own.tasks.empty()) {
+          dir = own.tasks.back();
+          own.tasks.pop_back();
+        }
+      }
+      for (int ivictim = 1; dir == -1 and ivictim < nthreads; ivictim++) {
+        work_deque &victim = deques[(ithread + ivictim) % nthreads];
+        std::lock_guard<std::mutex> lock(victim.mtx);
+        if (not victim.tasks.empty()) {
+          dir = victim.tasks.front();
+          victim.tasks.pop_front();
+        }
+      }
+      if (dir == -1) { std::this_thread::yield(); }
+      else { visit(dir, own); }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int ithread = 0; ithread < nthreads; ithread++) {
+    pool.emplace_back(worker, ithread);
+  }
+  for (auto &t : pool) { t.join(); }
+}
+
+/* Native filesystem scan
+ * Fills the flat tree from a real directory instead of a transcript.
+ * Folders are read with getdents64 and files sized with fstatat on a pool
+ * of threads. Only the insertion of the entries of a folder in the tree
+ * is serialized. Regular file sizes are the apparent sizes (st_size);
+ * symbolic links and special files are skipped. Subfolders are opened
+ * relative to the descriptor of their parent, which stays open until
+ * all of them are, so paths are never rebuilt nor limited by PATH_MAX. */
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+struct scan_entry {
+  std::string name;
+  bool is_dir;
+  long long size;
+};
+
+struct open_dir {
+/* Descriptor of a scanned folder, closed with its last reference. */
+  int fd;
+  explicit open_dir (int fd) : fd(fd) {}
+  ~open_dir () { close(fd); }
+};
+
+struct scan_task {
+  int inode; // Node of the folder in the tree.
+  std::shared_ptr<open_dir> parent; // Null for the root.
+  std::string name; // Relative to parent, or the root path.
+};
+
+bool read_dir_entries (int dirfd, std::vector<scan_entry> &entries) {
+/* List the subfolders and regular files of the open folder dirfd. */
+  alignas(linux_dirent64) char buf[1 << 15];
+  while (true) {
+    long nread = syscall(SYS_getdents64, dirfd, buf, sizeof(buf));
+    if (nread < 0) { return false; }
+    if (nread == 0) { return true; }
+    for (long offset = 0; offset < nread;) {
+      auto *ent = reinterpret_cast<linux_dirent64 *>(buf + offset);
+      offset += ent->d_reclen;
+      std::string name = ent->d_name;
+      if (name == "." or name == "..") { continue; }
+      unsigned char type = ent->d_type;
+      long long size = 0;
+      if (type == DT_REG or type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(dirfd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+          continue;
+        }
+        if (S_ISDIR(st.st_mode)) { type = DT_DIR; }
+        else if (S_ISREG(st.st_mode)) { type = DT_REG; size = st.st_size; }
+        else { continue; }
+      }
+      if (type == DT_DIR) { entries.push_back({name, true, 0}); }
+      else if (type == DT_REG) { entries.push_back({name, false, size}); }
+    }
+  }
+}
+
+bool scan_directory (dir_tree &tree, const std::string &root_path,
+                     int nthreads) {
+/* Build the tree of the directory root_path and compute the folder
+ * sizes. */
+  std::mutex mtx;
+  std::condition_variable cv;
+  // Taken last in first out: only the folders along the paths being
+  // explored keep a descriptor open, not a whole breadth-first level.
+  std::vector<scan_task> to_scan = {{0, nullptr, root_path}};
+  int in_progress = 0; // Folders taken from the queue, not yet scanned.
+  bool root_ok = true;
+
+  auto path_of = [&](const scan_task &task) {
+    // Full path, for error messages only.
+    std::string path = task.name;
+    for (int inode = tree.nodes[task.inode].parent; inode > 0;
+         inode = tree.nodes[inode].parent) {
+      path = tree.name(inode) + "/" + path;
+    }
+    return (task.inode == 0) ? path : root_path + "/" + path;
+  };
+
+  auto worker = [&]() {
+    std::vector<scan_entry> entries;
+    while (true) {
+      scan_task dir;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() { return !to_scan.empty() or in_progress == 0; });
+        if (to_scan.empty()) { return; }
+        dir = std::move(to_scan.back());
+        to_scan.pop_back();
+        in_progress++;
+      }
+      entries.clear();
+      // Links below the root are skipped, but a linked root is followed.
+      int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC
+                  | (dir.parent ? O_NOFOLLOW : 0);
+      int dirfd = openat(dir.parent ? dir.parent->fd : AT_FDCWD,
+                         dir.name.c_str(), flags);
+      dir.parent.reset();
+      bool read_ok = (dirfd >= 0) and read_dir_entries(dirfd, entries);
+      std::shared_ptr<open_dir> self;
+      if (dirfd >= 0) { self = std::make_shared<open_dir>(dirfd); }
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (not read_ok) {
+          std::cerr << "Cannot read " << path_of(dir) << std::endl;
+          if (dir.inode == 0) { root_ok = false; }
+        }
+        tree.cur_dir = dir.inode;
+        for (auto &entry : entries) {
+          int inode = tree.add_node(entry.name, not entry.is_dir, entry.size);
+          if (entry.is_dir) { to_scan.push_back({inode, self, entry.name}); }
+        }
+        in_progress--;
+      }
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (int ithread = 0; ithread < nthreads; ithread++) {
+    pool.emplace_back(worker);
+  }
+  for (auto &t : pool) { t.join(); }
+  tree.cur_dir = 0;
+  compute_sizes_parallel(tree, nthreads);
+  return root_ok;
+}
+
+/* Sorted index of the folder sizes
+ * Built once per tree. With the sizes sorted and their prefix sums, both
+ * threshold queries are a binary search. */
+class size_index {
+  public:
+    std::vector<long long> sizes; // Folder sizes, increasing.
+    std::vector<long long> prefix; // prefix[i]: sum of the first i sizes.
+
+    size_index (const dir_tree &tree);
+
+    long long sum_at_most (long long max_size) const;
+    long long smallest_at_least (long long min_size) const;
+};
+
+size_index::size_index (const dir_tree &tree) {
+  for (auto &node : tree.nodes) {
+    if (not node.is_file) { sizes.push_back(node.size); }
+  }
+  std::sort(sizes.begin(), sizes.end());
+  prefix.resize(sizes.size() + 1, 0);
+  std::partial_sum(sizes.begin(), sizes.end(), prefix.begin() + 1);
+}
+
+long long sorted_sum_at_most (const long long *sizes, const long long *prefix,
+                              std::size_t n, long long max_size) {
+/* Total of the sorted sizes that are at most max_size. */
+  auto end = std::upper_bound(sizes, sizes + n, max_size);
+  return prefix[end - sizes];
+}
+
+long long sorted_smallest_at_least (const long long *sizes, std::size_t n,
+                                    long long min_size) {
+/* Smallest of the sorted sizes that is at least min_size. -1 if none. */
+  auto found = std::lower_bound(sizes, sizes + n, min_size);
+  return (found == sizes + n) ? -1 : *found;
+}
+
+long long size_index::sum_at_most (long long max_size) const {
+/* Total size of the folders of size at most max_size. */
+  return sorted_sum_at_most(sizes.data(), prefix.data(), sizes.size(),
+                            max_size);
+}
+
+long long size_index::smallest_at_least (long long min_size) const {
+/* Size of the smallest folder of size at least min_size. -1 if none. */
+  return sorted_smallest_at_least(sizes.data(), sizes.size(), min_size);
+}
+
+/* Binary tree image
+ * The built tree and its size index, written as one file that can be
+ * mapped back and queried as is. Links are node indices and names are
+ * offsets in the pool, so the image does not depend on where it is
+ * mapped. Layout: header, nodes, name starts, sorted folder sizes,
+ * prefix sums, name pool. */
+struct image_header {
+  char magic[8];
+  std::uint64_t nnodes;
+  std::uint64_t nnames;
+  std::uint64_t pool_size;
+  std::uint64_t ndirs;
+};
+
+struct image_node {
+  std::int32_t parent;
+  std::int32_t first_child;
+  std::int32_t next_sibling;
+  std::int32_t name_id;
+  std::int64_t size;
+  std::int32_t is_file;
+  std::int32_t unused;
+};
+
+const char image_magic[8] = {'A', 'O', 'C', '7', 'T', 'R', 'E', 'E'};
+
+bool save_tree_image (const dir_tree &tree, const size_index &index,
+                      const std::string &path) {
+/* Write the tree and its size index to path. */
+  image_header header;
+  std::copy(image_magic, image_magic + 8, header.magic);
+  header.nnodes = tree.nodes.size();
+  header.nnames = tree.name_starts.size() - 1;
+  header.pool_size = tree.name_pool.size();
+  header.ndirs = index.sizes.size();
+
+  std::vector<image_node> nodes;
+  for (auto &node : tree.nodes) {
+    nodes.push_back({node.parent, node.first_child, node.next_sibling,
+                     node.name_id, node.size, node.is_file, 0});
+  }
+  std::vector<std::int64_t> name_starts(tree.name_starts.begin(),
+                                        tree.name_starts.end());
+
+  std::ofstream output(path, std::ios::binary);
+  output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  output.write(reinterpret_cast<const char *>(nodes.data()),
+               nodes.size() * sizeof(image_node));
+  output.write(reinterpret_cast<const char *>(name_starts.data()),
+               name_starts.size() * sizeof(std::int64_t));
+  output.write(reinterpret_cast<const char *>(index.sizes.data()),
+               index.sizes.size() * sizeof(long long));
+  output.write(reinterpret_cast<const char *>(index.prefix.data()),
+               index.prefix.size() * sizeof(long long));
+  output.write(tree.name_pool.data(), tree.name_pool.size());
+  return bool(output);
+}
+
+class tree_image {
+/* Read-only view of a mapped tree image. Nothing is parsed or copied. */
+  public:
+    const image_header *header = nullptr;
+    const image_node *nodes = nullptr;
+    const std::int64_t *name_starts = nullptr;
+    const long long *sizes = nullptr; // Folder sizes, increasing.
+    const long long *prefix = nullptr;
+    const char *name_pool = nullptr;
+
+    ~tree_image ();
+    bool load (const std::string &path);
+
+    std::string name (int inode) const;
+    long long used_space () const;
+    long long sum_at_most (long long max_size) const;
+    long long smallest_at_least (long long min_size) const;
+
+  private:
+    void *map = nullptr;
+    std::size_t map_size = 0;
+};
+
+tree_image::~tree_image () {
+  if (map) { munmap(map, map_size); }
+}
+
+bool tree_image::load (const std::string &path) {
+/* Map the image file and point the sections into it. */
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "Cannot open " << path << std::endl;
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  map_size = st.st_size;
+  if (map_size >= sizeof(image_header)) {
+    map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) { map = nullptr; }
+  }
+  close(fd);
+  if (not map) {
+    std::cerr << "Cannot map " << path << std::endl;
+    return false;
+  }
+
+  const char *base = static_cast<const char *>(map);
+  header = reinterpret_cast<const image_header *>(base);
+  std::size_t expected = sizeof(image_header)
+    + header->nnodes * sizeof(image_node)
+    + (header->nnames + 1) * sizeof(std::int64_t)
+    + (2 * header->ndirs + 1) * sizeof(long long)
+    + header->pool_size;
+  if (not std::equal(image_magic, image_magic + 8, header->magic)
+      or expected != map_size) {
+    std::cerr << "Not a tree image: " << path << std::endl;
+    return false;
+  }
+  const char *section = base + sizeof(image_header);
+  nodes = reinterpret_cast<const image_node *>(section);
+  section += header->nnodes * sizeof(image_node);
+  name_starts = reinterpret_cast<const std::int64_t *>(section);
+  section += (header->nnames + 1) * sizeof(std::int64_t);
+  sizes = reinterpret_cast<const long long *>(section);
+  section += header->ndirs * sizeof(long long);
+  prefix = reinterpret_cast<const long long *>(section);
+  section += (header->ndirs + 1) * sizeof(long long);
+  name_pool = section;
+  return true;
+}
+
+std::string tree_image::name (int inode) const {
+  int id = nodes[inode].name_id;
+  return std::string(name_pool + name_starts[id],
+                     name_starts[id + 1] - name_starts[id]);
+}
+
+long long tree_image::used_space () const {
+  return nodes[0].size;
+}
+
+long long tree_image::sum_at_most (long long max_size) const {
+  return sorted_sum_at_most(sizes, prefix, header->ndirs, max_size);
+}
+
+long long tree_image::smallest_at_least (long long min_size) const {
+  return sorted_smallest_at_least(sizes, header->ndirs, min_size);
+}
+
+template <typename index_t>
+void print_answers (const index_t &index, long long used_space) {
+/* Print the part 1 and part 2 answers from a folder size index. */
+  /* Summing the size of all of the small folders */
+  std::cout << "Total size of folders of size at most 100k: "
+            << index.sum_at_most(100000) << std::endl;
+
+  /* Part 2 */
+  /* Total used space */
+  long long fs_space = 70000000;
+  long long free_space = fs_space - used_space;
+  long long target_free_space = 30000000;
+  long long space_to_free = target_free_space - free_space;
+  std::cout << "Used space: " << used_space << std::endl;
+  std::cout << "Space to free: " << space_to_free << std::endl;
+  std::cout << "Smallest directory size for deletion: "
+            << index.smallest_at_least(space_to_free) << std::endl;
+}
+
+template <typename index_t>
+int run_queries (const index_t &index, std::ifstream &queries) {
+/* Answer threshold query lines: "<= X" for the total size of the folders
+ * of size at most X, ">= Y" for the smallest folder of size at least Y. */
+  std::string line;
+  while (std::getline(queries, line)) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) { continue; }
+    // Threshold after the two-character operator, spaces optional.
+    const char *number = line.c_str() + std::min<std::size_t>(2, line.size());
+    char *number_end;
+    errno = 0;
+    long long threshold = std::strtoll(number, &number_end, 10);
+    bool parsed = (number_end != number and errno == 0
+                   and std::string(number_end).find_first_not_of(" \t\r")
+                       == std::string::npos);
+    if (not parsed) {
+      std::cerr << "Query threshold not recognized: " << line << std::endl;
+      return 1;
+    }
+    if (line.compare(0, 2, "<=") == 0) {
+      std::cout << line << ": " << index.sum_at_most(threshold) << std::endl;
+    } else if (line.compare(0, 2, ">=") == 0) {
+      std::cout << line << ": " << index.smallest_at_least(threshold)
+                << std::endl;
+    } else {
+      std::cerr << "Query not recognized: " << line << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Live tree: folder sizes and answers kept current under updates */
+class live_tree {
+/* Wraps a finished dir_tree. Each file change passes its size delta up the
+ * parent chain, O(depth). The sum of the small folders is adjusted for
+ * every folder on the way, and a multiset of the folder sizes answers the
+ * deletion candidate query in O(log n). */
+  public:
+    dir_tree tree;
+    long long small_limit; // Part 1 folder size limit.
+    long long small_sum = 0; // Part 1 answer.
+    std::multiset<long long> dir_sizes;
+
+    live_tree (const dir_tree &_tree, long long _small_limit);
+
+    // False, with no change, if name is a folder of dir.
+    bool set_file (int dir, const std::string &name, long long size);
+    bool remove_file (int dir, const std::string &name);
+    void process_line (const std::string &line);
+    long long smallest_dir_above (long long min_size) const;
+
+  private:
+    void track (long long size, int sign); // Count a folder size in or out.
+    void propagate (int dir, long long delta);
+};
+
+live_tree::live_tree (const dir_tree &_tree, long long _small_limit) {
+  tree = _tree;
+  small_limit = _small_limit;
+  for (auto &node : tree.nodes) {
+    if (not node.is_file) { track(node.size, 1); }
+  }
+}
+
+void live_tree::track (long long size, int sign) {
+  if (sign > 0) { dir_sizes.insert(size); }
+  else { dir_sizes.erase(dir_sizes.find(size)); }
+  if (size <= small_limit) { small_sum += sign * size; }
+}
+
+void live_tree::propagate (int dir, long long delta) {
+/* Add delta to the size of dir and all of its ancestors. The delta is
+ * also marked as reported, since the parents already have it. */
+  if (delta == 0) { return; }
+  for (int inode = dir; inode != -1; inode = tree.nodes[inode].parent) {
+    tree_node &node = tree.nodes[inode];
+    track(node.size, -1);
+    node.size += delta;
+    if (node.parent != -1) { node.reported += delta; }
+    track(node.size, 1);
+  }
+}
+
+bool live_tree::set_file (int dir, const std::string &name, long long size) {
+/* Add a file to dir, or change its size if it is already there. */
+  int file = tree.find_child(dir, name);
+  if (file != -1 and not tree.nodes[file].is_file) { return false; }
+  if (file == -1) {
+    int saved_dir = tree.cur_dir;
+    tree.cur_dir = dir;
+    file = tree.add_node(name, true, 0);
+    tree.cur_dir = saved_dir;
+  }
+  long long delta = size - tree.nodes[file].size;
+  tree.nodes[file].size = size;
+  propagate(dir, delta);
+  return true;
+}
+
+bool live_tree::remove_file (int dir, const std::string &name) {
+/* A removed file is kept in the tree with a null size, so it can come
+ * back without a new node. */
+  int file = tree.find_child(dir, name);
+  if (file == -1) { return true; }
+  return set_file(dir, name, 0);
+}
+
+void live_tree::process_line (const std::string &line) {
+/* Process one more transcript line. Listing a known file again updates
+ * its size. "$ rm <name>" removes a file from the current folder. Updates
+ * naming a folder are reported and skipped. */
+  if (line.empty()) { return; }
+  if (line.compare(0, 5, "$ rm ") == 0) {
+    if (not remove_file(tree.cur_dir, line.substr(5))) {
+      std::cerr << "Cannot remove folder: " << line << std::endl;
+    }
+  }
+  else if (is_input(line)) { tree.process_line(line); }
+  else if (output_is_dir(line)) {
+    std::string dir_name = parse_dir_name(line);
+    if (tree.find_child(tree.cur_dir, dir_name) == -1) {
+      tree.add_dir(dir_name);
+      track(0, 1);
+    }
+  }
+  else {
+    auto file_data = parse_filedata(line);
+    if (not set_file(tree.cur_dir, file_data.second, file_data.first)) {
+      std::cerr << "File name already used by a folder: " << line
+                << std::endl;
+    }
+  }
+}
+
+long long live_tree::smallest_dir_above (long long min_size) const {
+/* Size of the smallest folder of size at least min_size. -1 if none. */
+  auto found = dir_sizes.lower_bound(min_size);
+  return (found == dir_sizes.end()) ? -1 : *found;
+}
+
+int solve_with_graph (std::ifstream &input) {
+/* Original solution, on the Boost Graph. */
   graph_builder gb;
 
-  std::ifstream input(argv[1]);
   std::string line;
   std::getline(input, line); // Skip first line (root folder)
   while(std::getline(input, line)) {
@@ -242,43 +1130,182 @@ int main (int argc, char *argv[]) {
   graph_sizes gs (gb.g);
   gs.sort_topo();
   gs.compute_dirs_size();
-  /*
-  for (auto vert : gs.topo_dirs) {
-    std::cout << gs.g[vert].name << " " << gs.g[vert].size << std::endl;
-  }
-  */
   /* Finding all folders with size at most 100k */
   std::vector<vertex_desc> small_folders;
   std::copy_if(gs.topo_dirs.begin(), gs.topo_dirs.end(),
                std::back_inserter(small_folders),
-               [gs](vertex_desc v){return gs.g[v].size <= 100000;});
+               [&gs](vertex_desc v){return gs.g[v].size <= 100000;});
   /* Summing the size of all of the small folders */
-  int small_folders_sum = 
-    std::accumulate(small_folders.begin(), small_folders.end(), 0,
-    [gs](int cur_sum, vertex_desc v)
+  long long small_folders_sum =
+    std::accumulate(small_folders.begin(), small_folders.end(), 0LL,
+    [&gs](long long cur_sum, vertex_desc v)
         {return cur_sum + gs.g[v].size;});
   std::cout << "Total size of folders of size at most 100k: "
             << small_folders_sum << std::endl;
 
   /* Part 2 */
   /* Total used space */
-  int fs_space = 70000000;
-  int used_space = gs.g[gs.topo_dirs.back()].size;
-  int free_space = fs_space - used_space;
-  int target_free_space = 30000000;
-  int space_to_free = target_free_space - free_space;
+  long long fs_space = 70000000;
+  long long used_space = gs.g[gs.topo_dirs.back()].size;
+  long long free_space = fs_space - used_space;
+  long long target_free_space = 30000000;
+  long long space_to_free = target_free_space - free_space;
   std::cout << "Used space: " << used_space << std::endl;
   std::cout << "Space to free: " << space_to_free << std::endl;
   /* Folders big enough to delete */
   std::vector<vertex_desc> big_folders;
   std::copy_if(gs.topo_dirs.begin(), gs.topo_dirs.end(),
                std::back_inserter(big_folders),
-               [gs, space_to_free](vertex_desc v)
+               [&gs, space_to_free](vertex_desc v)
                {return gs.g[v].size >= space_to_free;});
   /* Find the smallest of these folders */
   std::sort(big_folders.begin(), big_folders.end(),
-            [gs](vertex_desc a, vertex_desc b)
+            [&gs](vertex_desc a, vertex_desc b)
             {return gs.g[a].size < gs.g[b].size;});
   std::cout << "Smallest directory size for deletion: "
             << gs.g[big_folders.front()].size << std::endl;
+  return 0;
+}
+
+std::vector<std::string> wide_transcript (int width) {
+/* Synthetic transcript of a root folder holding width folders, each
+ * visited once. */
+  std::vector<std::string> lines = {"$ cd /", "$ ls"};
+  for (int i = 0; i < width; i++) {
+    lines.push_back("dir d" + std::to_string(i));
+  }
+  for (int i = 0; i < width; i++) {
+    lines.push_back("$ cd d" + std::to_string(i));
+    lines.push_back("$ ls");
+    lines.push_back("1000 f");
+    lines.push_back("$ cd ..");
+  }
+  return lines;
+}
+
+void bench_wide (int width) {
+/* Time the parsing of a wide tree with the hashed child lookup of the
+ * flat tree and with the linear child search of the graph builder. */
+  auto lines = wide_transcript(width);
+
+  auto start = std::chrono::steady_clock::now();
+  dir_tree tree;
+  for (auto &line : lines) { tree.process_line(line); }
+  tree.finish();
+  auto end = std::chrono::steady_clock::now();
+  std::chrono::duration<double> tree_time = end - start;
+
+  start = std::chrono::steady_clock::now();
+  graph_builder gb;
+  for (std::size_t iline = 1; iline < lines.size(); iline++) {
+    gb.process_line(lines[iline]);
+  }
+  end = std::chrono::steady_clock::now();
+  std::chrono::duration<double> graph_time = end - start;
+
+  std::cout << "Width: " << width << std::endl;
+  std::cout << "Flat tree, hashed cd: " << tree_time.count() << " s"
+            << std::endl;
+  std::cout << "Graph, linear cd: " << graph_time.count() << " s"
+            << std::endl;
+  std::cout << "Root size: " << tree.nodes.front().size << std::endl;
+}
+
+int main (int argc, char *argv[]) {
+  std::cout << "# Day 7#" << std::endl;
+
+  if (argc < 2 or argc > 4) {
+    std::cerr << "Please provide the input file." << std::endl;
+    std::cerr << "Usage: day7 <input> [--graph | --live <updates>"
+              << " | --queries <queries> | --parallel-sizes"
+              << " | --save <image>]" << std::endl;
+    std::cerr << "       day7 --bench-wide <width>" << std::endl;
+    std::cerr << "       day7 --scan <directory>" << std::endl;
+    std::cerr << "       day7 --load <image> [queries]" << std::endl;
+    return 1;
+  }
+
+  if (argc >= 3 and std::string(argv[1]) == "--load") {
+    /* Querying a saved tree image: no parsing at all. */
+    tree_image image;
+    if (not image.load(argv[2])) { return 1; }
+    print_answers(image, image.used_space());
+    if (argc == 4) {
+      std::ifstream queries(argv[3]);
+      return run_queries(image, queries);
+    }
+    return 0;
+  }
+
+  if (argc == 3 and std::string(argv[1]) == "--bench-wide") {
+    bench_wide(std::stoi(argv[2]));
+    return 0;
+  }
+
+  /* Part 1 solution outline
+ *   * Parse all folders and files into the flat tree.
+ *     * Detect the type and subtype of lines: input line (cd or ls),
+ *       output line (dir or file).
+ *     * Each folder passes its size to its parent when we leave it.
+ *   * Sort the folder sizes and sum them with a prefix sum: the size
+ *     of the folders with size at most X is found by binary search.
+ * The original Boost Graph solution, with a topological sort of the
+ * folders, is kept behind --graph. */
+
+  int nthreads = std::max(1u, std::thread::hardware_concurrency());
+  dir_tree tree;
+  std::string line;
+  if (argc == 3 and std::string(argv[1]) == "--scan") {
+    /* Scanning a real directory instead of parsing a transcript */
+    if (not scan_directory(tree, argv[2], nthreads)) { return 1; }
+  } else {
+    std::ifstream input(argv[1]);
+    if (argc == 3 and std::string(argv[2]) == "--graph") {
+      return solve_with_graph(input);
+    }
+
+    /* Parsing the input text */
+    while(std::getline(input, line)) {
+      tree.process_line(line);
+    }
+    tree.finish();
+    if (argc == 3 and std::string(argv[2]) == "--parallel-sizes") {
+      /* Sum the folder sizes again, as one parallel pass over the tree. */
+      compute_sizes_parallel(tree, nthreads);
+    }
+  }
+  size_index index(tree);
+  print_answers(index, tree.nodes.front().size);
+
+  if (argc == 4 and std::string(argv[2]) == "--queries") {
+    std::ifstream queries(argv[3]);
+    return run_queries(index, queries);
+  }
+
+  if (argc == 4 and std::string(argv[2]) == "--save") {
+    if (not save_tree_image(tree, index, argv[3])) {
+      std::cerr << "Cannot write " << argv[3] << std::endl;
+      return 1;
+    }
+  }
+
+  if (argc == 4 and std::string(argv[2]) == "--live") {
+    /* Updates: more transcript lines, applied incrementally. */
+    live_tree live(tree, 100000);
+    std::ifstream updates(argv[3]);
+    while (std::getline(updates, line)) {
+      live.process_line(line);
+    }
+    long long fs_space = 70000000;
+    long long target_free_space = 30000000;
+    long long used_space = live.tree.nodes.front().size;
+    long long space_to_free = target_free_space - (fs_space - used_space);
+    std::cout << "# After updates #" << std::endl;
+    std::cout << "Total size of folders of size at most 100k: "
+              << live.small_sum << std::endl;
+    std::cout << "Used space: " << used_space << std::endl;
+    std::cout << "Space to free: " << space_to_free << std::endl;
+    std::cout << "Smallest directory size for deletion: "
+              << live.smallest_dir_above(space_to_free) << std::endl;
+  }
 }
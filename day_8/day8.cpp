@@ -6,12 +6,28 @@
 #include <numeric>
 #include <functional>
 #include <utility>
+#include <cstdint>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <queue>
+#include <tuple>
+#include <array>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <Eigen/Core>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> height_mat;
 typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> visibility_map;
-typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> scenic_map;
+typedef Eigen::Matrix<long long, Eigen::Dynamic, Eigen::Dynamic> scenic_map;
 
 std::vector<std::string> parse_input (std::ifstream &input) {
 /* Parse the input file to a vector of line strings */
@@ -173,7 +189,7 @@ scenic_map compute_scenic_scores (const height_mat &heights) {
   for (int krow = 0; krow < heights.rows(); krow++) {
     for (int kcol = 0;  kcol < heights.cols(); kcol++) {
       scenic_scores(krow, kcol) =
-        right_view_dist(krow, kcol, heights)
+        (long long) right_view_dist(krow, kcol, heights)
       * left_view_dist(krow, kcol, heights)
       * bottom_view_dist(krow, kcol, heights)
       * top_view_dist(krow, kcol, heights);
@@ -182,19 +198,1049 @@ scenic_map compute_scenic_scores (const height_mat &heights) {
   return scenic_scores;
 }
 
+/* Top-K scenic spots by branch and bound */
+struct scenic_spot {
+  long long score;
+  int row;
+  int col;
+};
+
+std::vector<scenic_spot> top_scenic_spots (const height_mat &heights,
+                                           int k) {
+/* The k best scenic scores, best first. A view distance is at most the
+ * distance to the edge or to the nearest tree at least as tall as the
+ * viewer. Trees of the tallest height in the forest, and of the level
+ * just below, give this bound for every tree in four sweeps; a tree of
+ * height 0 also sees at most 1 each way. Trees are then evaluated with the
+ * view distance functions by batches of best bounds, growing twofold, and
+ * dropped once their bound is no better than the k-th best score found.
+ * A ray walk stops at the blocker of the bound, so an evaluation costs no
+ * more than its bound allows. When few trees reach these two levels, the
+ * bounds are loose and this can be slower than the full O(n) solve. */
+  int rows = heights.rows();
+  int cols = heights.cols();
+  std::vector<scenic_spot> best;
+  if (k <= 0 or rows == 0 or cols == 0) { return best; }
+
+  int tallest = heights.maxCoeff();
+  auto reach = [tallest](int height, int pos, int last_top, int last_high,
+                         int edge) {
+    // View distance bound from the last trees of the two top levels.
+    int blocker = (height >= tallest) ? last_top : last_high;
+    return (blocker == -1) ? edge : std::abs(pos - blocker);
+  };
+  std::vector<long long> bound(std::size_t(rows) * cols);
+  auto at = [cols](int r, int c) { return std::size_t(r) * cols + c; };
+  for (int r = 0; r < rows; r++) { // Left, then right.
+    for (int c = 0, last_top = -1, last_high = -1; c < cols; c++) {
+      int h = heights(r, c);
+      bound[at(r, c)] = reach(h, c, last_top, last_high, c);
+      if (h >= tallest - 1) { last_high = c; }
+      if (h == tallest) { last_top = c; }
+    }
+    for (int c = cols - 1, last_top = -1, last_high = -1; c >= 0; c--) {
+      int h = heights(r, c);
+      bound[at(r, c)] *= reach(h, c, last_top, last_high, cols - 1 - c);
+      if (h >= tallest - 1) { last_high = c; }
+      if (h == tallest) { last_top = c; }
+    }
+  }
+  std::vector<int> last_top(cols, -1), last_high(cols, -1);
+  for (int r = 0; r < rows; r++) { // Up.
+    for (int c = 0; c < cols; c++) {
+      int h = heights(r, c);
+      bound[at(r, c)] *= reach(h, r, last_top[c], last_high[c], r);
+      if (h >= tallest - 1) { last_high[c] = r; }
+      if (h == tallest) { last_top[c] = r; }
+    }
+  }
+  std::fill(last_top.begin(), last_top.end(), -1);
+  std::fill(last_high.begin(), last_high.end(), -1);
+  for (int r = rows - 1; r >= 0; r--) { // Down.
+    for (int c = 0; c < cols; c++) {
+      int h = heights(r, c);
+      bound[at(r, c)] *= reach(h, r, last_top[c], last_high[c], rows - 1 - r);
+      if (h >= tallest - 1) { last_high[c] = r; }
+      if (h == tallest) { last_top[c] = r; }
+      if (h == 0) { // Sees at most the next tree each way.
+        bound[at(r, c)] = std::min(1LL, bound[at(r, c)]);
+      }
+    }
+  }
+
+  auto worse = [](const scenic_spot &a, const scenic_spot &b) {
+    return a.score > b.score;
+  };
+  std::vector<scenic_spot> heap; // Min-heap of the k best so far.
+  auto hopeless = [&](std::size_t icell) { // Cannot enter the k best.
+    return int(heap.size()) == k and bound[icell] <= heap.front().score;
+  };
+  std::vector<std::size_t> candidates(bound.size());
+  std::iota(candidates.begin(), candidates.end(), 0);
+  auto by_bound = [&](std::size_t a, std::size_t b) {
+    return bound[a] > bound[b];
+  };
+  std::size_t batch = std::max<std::size_t>(k, 1024);
+  while (not candidates.empty()) {
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                    hopeless), candidates.end());
+    std::size_t nbatch = std::min(batch, candidates.size());
+    std::nth_element(candidates.begin(), candidates.begin() + nbatch,
+                     candidates.end(), by_bound);
+    std::sort(candidates.begin(), candidates.begin() + nbatch, by_bound);
+    for (std::size_t i = 0; i < nbatch; i++) {
+      std::size_t icell = candidates[i];
+      if (hopeless(icell)) { break; } // So are the next ones.
+      int krow = icell / cols;
+      int kcol = icell % cols;
+      long long score = (long long) right_view_dist(krow, kcol, heights)
+                        * left_view_dist(krow, kcol, heights)
+                        * bottom_view_dist(krow, kcol, heights)
+                        * top_view_dist(krow, kcol, heights);
+      if (int(heap.size()) < k) {
+        heap.push_back({score, krow, kcol});
+        std::push_heap(heap.begin(), heap.end(), worse);
+      } else if (score > heap.front().score) {
+        std::pop_heap(heap.begin(), heap.end(), worse);
+        heap.back() = {score, krow, kcol};
+        std::push_heap(heap.begin(), heap.end(), worse);
+      }
+    }
+    candidates.erase(candidates.begin(), candidates.begin() + nbatch);
+    batch *= 2;
+  }
+  std::sort_heap(heap.begin(), heap.end(), worse);
+  return heap;
+}
+
+template <typename height_fn>
+void line_view_dists (int len, height_fn height_at, std::vector<int> &dists,
+                      std::vector<int> &stack) {
+/* View distances looking back along a line of trees, in O(len).
+ * The stack holds the positions of the trees that can still block the
+ * view, with decreasing heights. Trees lower than the current one are
+ * popped: they cannot block anyone behind it. */
+  stack.clear();
+  for (int i = 0; i < len; i++) {
+    int cur_height = height_at(i);
+    while (not stack.empty() and height_at(stack.back()) < cur_height) {
+      stack.pop_back();
+    }
+    dists[i] = stack.empty() ? i : i - stack.back();
+    stack.push_back(i);
+  }
+}
+
+scenic_map compute_scenic_scores_stack (const height_mat &heights) {
+/* Same scores as compute_scenic_scores, with one monotonic stack sweep per
+ * row and column in each direction: O(rows x cols) in total. */
+  int rows = heights.rows();
+  int cols = heights.cols();
+  scenic_map scenic_scores = scenic_map::Ones(rows, cols);
+  std::vector<int> dists(std::max(rows, cols));
+  std::vector<int> stack;
+  for (int irow = 0; irow < rows; irow++) {
+    line_view_dists(cols, [&](int i) { return heights(irow, i); },
+                    dists, stack); // Looking left.
+    for (int icol = 0; icol < cols; icol++) {
+      scenic_scores(irow, icol) *= dists[icol];
+    }
+    line_view_dists(cols, [&](int i) { return heights(irow, cols - 1 - i); },
+                    dists, stack); // Looking right.
+    for (int icol = 0; icol < cols; icol++) {
+      scenic_scores(irow, cols - 1 - icol) *= dists[icol];
+    }
+  }
+  for (int icol = 0; icol < cols; icol++) {
+    line_view_dists(rows, [&](int i) { return heights(i, icol); },
+                    dists, stack); // Looking up.
+    for (int irow = 0; irow < rows; irow++) {
+      scenic_scores(irow, icol) *= dists[irow];
+    }
+    line_view_dists(rows, [&](int i) { return heights(rows - 1 - i, icol); },
+                    dists, stack); // Looking down.
+    for (int irow = 0; irow < rows; irow++) {
+      scenic_scores(rows - 1 - irow, icol) *= dists[irow];
+    }
+  }
+  return scenic_scores;
+}
+
+/* Packed forest
+ * One byte per tree height, stored row by row. The paths that sweep
+ * columns as lines call transpose() for a column-major copy, so that they
+ * also read memory with unit stride. Visibility is one bit per tree. */
+class packed_forest {
+  public:
+    int rows = 0;
+    int cols = 0;
+    std::vector<std::uint8_t> by_row; // Heights, row-major.
+    std::vector<std::uint8_t> by_col; // Heights, column-major, on demand.
+
+    packed_forest () = default;
+    packed_forest (const std::vector<std::string> &str_vec);
+    bool load_mapped (const std::string &path);
+
+    std::uint8_t at (int irow, int icol) const {
+      return by_row[std::size_t(irow) * cols + icol];
+    }
+    void transpose (); // Fill by_col from by_row.
+};
+
+packed_forest::packed_forest (const std::vector<std::string> &str_vec) {
+  auto dims = input_dims(str_vec);
+  rows = dims.first;
+  cols = dims.second;
+  by_row.resize(std::size_t(rows) * cols);
+  for (int irow = 0; irow < rows; irow++) {
+    for (int icol = 0; icol < cols; icol++) {
+      by_row[std::size_t(irow) * cols + icol] = str_vec[irow][icol] - '0';
+    }
+  }
+}
+
+bool digits_to_heights (const char *digits, std::uint8_t *out, int len) {
+/* Convert a line of ASCII digits to heights, 32 bytes at a time. False if
+ * the line holds anything else than digits. */
+  int i = 0;
+  bool all_digits = true;
+#ifdef __AVX2__
+  const __m256i zero_char = _mm256_set1_epi8('0');
+  const __m256i nine = _mm256_set1_epi8(9);
+  __m256i bad = _mm256_setzero_si256(); // Bytes above 9, as unsigned.
+  for (; i + 32 <= len; i += 32) {
+    __m256i chars = _mm256_loadu_si256(
+                      reinterpret_cast<const __m256i *>(digits + i));
+    __m256i heights = _mm256_sub_epi8(chars, zero_char);
+    bad = _mm256_or_si256(bad, _mm256_xor_si256(
+            _mm256_max_epu8(heights, nine), nine));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), heights);
+  }
+  all_digits = _mm256_testz_si256(bad, bad);
+#endif
+  for (; i < len; i++) {
+    out[i] = digits[i] - '0';
+    all_digits = all_digits and out[i] <= 9;
+  }
+  return all_digits;
+}
+
+bool packed_forest::load_mapped (const std::string &path) {
+/* Fill the forest straight from the mapped input file, without going
+ * through line strings. The row width is the position of the first
+ * newline; every row must have that width. */
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "Cannot open " << path << std::endl;
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  std::size_t size = st.st_size;
+  void *map = (size > 0) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                         : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) {
+    std::cerr << "Cannot map " << path << std::endl;
+    return false;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  const char *data = static_cast<const char *>(map);
+
+  const char *newline = static_cast<const char *>(std::memchr(data, '\n',
+                                                               size));
+  std::size_t width = newline ? newline - data : size;
+  std::size_t stride = width + 1; // Row and its newline.
+  if (width > 0 and data[width - 1] == '\r') { width--; } // CRLF input.
+  std::size_t nrows = size / stride + ((size % stride) >= width ? 1 : 0);
+  if (width == 0) { nrows = 0; }
+  bool ok = (size % stride == 0 or size % stride >= width);
+  if (not ok) { std::cerr << "Truncated last row in " << path << std::endl; }
+  for (std::size_t irow = 0; (ok and irow + 1 < nrows); irow++) {
+    ok = (data[irow * stride + stride - 1] == '\n');
+    if (not ok) {
+      std::cerr << "Rows of different widths in " << path << std::endl;
+    }
+  }
+  if (ok) {
+    rows = nrows;
+    cols = width;
+    by_row.resize(std::size_t(rows) * cols);
+    for (int irow = 0; (ok and irow < rows); irow++) {
+      ok = digits_to_heights(data + irow * stride,
+                             &by_row[std::size_t(irow) * cols], cols);
+      if (not ok) {
+        std::cerr << "Non-digit height on row " << irow << " of " << path
+                  << std::endl;
+      }
+    }
+  }
+  munmap(map, size);
+  return ok;
+}
+
+void packed_forest::transpose () {
+/* Transposition by 64x64 tiles, so both sides stay in cache. */
+  const int tile = 64;
+  by_col.resize(by_row.size());
+  for (int row0 = 0; row0 < rows; row0 += tile) {
+    for (int col0 = 0; col0 < cols; col0 += tile) {
+      int row_end = std::min(rows, row0 + tile);
+      int col_end = std::min(cols, col0 + tile);
+      for (int irow = row0; irow < row_end; irow++) {
+        for (int icol = col0; icol < col_end; icol++) {
+          by_col[std::size_t(icol) * rows + irow] = at(irow, icol);
+        }
+      }
+    }
+  }
+}
+
+class bit_map {
+/* Row-major map of one bit per tree. */
+  public:
+    int rows = 0;
+    int cols = 0;
+    std::vector<std::uint64_t> words;
+
+    bit_map (int _rows, int _cols);
+    void set (int irow, int icol);
+    bool get (int irow, int icol) const;
+    void set_bits (int irow, int icol, std::uint32_t mask);
+    long long count () const;
+};
+
+bit_map::bit_map (int _rows, int _cols) {
+  rows = _rows;
+  cols = _cols;
+  words.assign((std::size_t(rows) * cols + 63) / 64, 0);
+}
+
+void bit_map::set (int irow, int icol) {
+  std::size_t ibit = std::size_t(irow) * cols + icol;
+  words[ibit / 64] |= std::uint64_t(1) << (ibit % 64);
+}
+
+bool bit_map::get (int irow, int icol) const {
+  std::size_t ibit = std::size_t(irow) * cols + icol;
+  return (words[ibit / 64] >> (ibit % 64)) & 1;
+}
+
+void bit_map::set_bits (int irow, int icol, std::uint32_t mask) {
+/* Set the bits of mask at (irow, icol) and after, along the row. */
+  std::size_t ibit = std::size_t(irow) * cols + icol;
+  std::size_t iword = ibit / 64;
+  int shift = ibit % 64;
+  words[iword] |= std::uint64_t(mask) << shift;
+  std::uint64_t spill = (shift > 32) ? std::uint64_t(mask) >> (64 - shift) : 0;
+  if (spill != 0) { words[iword + 1] |= spill; } // May be the last word.
+}
+
+long long bit_map::count () const {
+  long long nbits = 0;
+  for (auto word : words) { nbits += __builtin_popcountll(word); }
+  return nbits;
+}
+
+void probe_line_sides (const std::uint8_t *line, int len, int iline,
+                       bit_map &visibs) {
+/* Mark the trees of a line visible from either of its ends. */
+  int max_height = -1;
+  for (int i = 0; (i < len and max_height < 9); i++) {
+    if (line[i] > max_height) {
+      max_height = line[i];
+      visibs.set(iline, i);
+    }
+  }
+  max_height = -1;
+  for (int i = len - 1; (i >= 0 and max_height < 9); i--) {
+    if (line[i] > max_height) {
+      max_height = line[i];
+      visibs.set(iline, i);
+    }
+  }
+}
+
+bit_map compute_visibility_packed (const packed_forest &forest) {
+/* Same visibility as compute_visibility_map, on the packed forest.
+ * Left and right probes run along the rows. Top and bottom probes also
+ * go row by row, with one running maximum per column, so that every
+ * probe reads the heights with unit stride. */
+  int rows = forest.rows;
+  int cols = forest.cols;
+  bit_map visibs(rows, cols);
+  for (int irow = 0; irow < rows; irow++) {
+    probe_line_sides(&forest.by_row[std::size_t(irow) * cols], cols, irow,
+                     visibs);
+  }
+  std::vector<int> max_heights(cols, -1);
+  for (int irow = 0; irow < rows; irow++) { // Top probe.
+    const std::uint8_t *line = &forest.by_row[std::size_t(irow) * cols];
+    for (int icol = 0; icol < cols; icol++) {
+      if (line[icol] > max_heights[icol]) {
+        max_heights[icol] = line[icol];
+        visibs.set(irow, icol);
+      }
+    }
+  }
+  std::fill(max_heights.begin(), max_heights.end(), -1);
+  for (int irow = rows - 1; irow >= 0; irow--) { // Bottom probe.
+    const std::uint8_t *line = &forest.by_row[std::size_t(irow) * cols];
+    for (int icol = 0; icol < cols; icol++) {
+      if (line[icol] > max_heights[icol]) {
+        max_heights[icol] = line[icol];
+        visibs.set(irow, icol);
+      }
+    }
+  }
+  return visibs;
+}
+
+/* Column summary
+ * What a sweep down the rows needs to remember of a column to finish its
+ * visibility and scenic scores, in constant space.
+ *   * Top: highest tree so far, and for every height the last row with a
+ *     tree at least that tall, which gives the view distance upwards.
+ *   * Bottom: the trees of the column not yet blocked from below, with
+ *     strictly decreasing heights, so at most 10 of them. A new tree
+ *     blocks those not taller than itself: they are not visible from the
+ *     bottom and their view down ends here. Trees left at the end are
+ *     visible from the bottom and see down to the edge. */
+struct column_summary {
+  int top_max = -1;
+  std::array<long long, 10> last_at_least; // Last row with height >= index.
+  int npending = 0;
+  std::array<std::uint8_t, 10> pending_height;
+  std::array<bool, 10> pending_counted; // Already counted as visible.
+  std::array<long long, 10> pending_row;
+  std::array<long long, 10> pending_score; // Score without the down view.
+
+  column_summary () { last_at_least.fill(-1); }
+
+  long long add_tree (long long irow, int height, bool counted,
+                      long long side_score) {
+  /* Add the next tree down the column, with its left and right score.
+   * Returns the best score among the trees it finishes, or 0. */
+    long long up = (last_at_least[height] == -1) ? irow
+             : irow - last_at_least[height];
+    for (int v = 0; v <= height; v++) { last_at_least[v] = irow; }
+    long long best = 0;
+    while (npending > 0 and pending_height[npending - 1] <= height) {
+      npending--; // Blocked from below by this tree.
+      best = std::max(best, pending_score[npending]
+                            * (irow - pending_row[npending]));
+    }
+    pending_height[npending] = height;
+    pending_counted[npending] = counted;
+    pending_row[npending] = irow;
+    pending_score[npending] = side_score * up;
+    npending++;
+    return best;
+  }
+
+  long long finish (long long rows, long long &nvisible) const {
+  /* Close the column after its last row: the trees still unblocked are
+   * visible from the bottom and see down to the edge. Returns their best
+   * score. */
+    long long best = 0;
+    for (int k = 0; k < npending; k++) {
+      if (not pending_counted[k]) { nvisible++; }
+      best = std::max(best, pending_score[k] * (rows - 1 - pending_row[k]));
+    }
+    return best;
+  }
+};
+
+long long max_scenic_score_packed (const packed_forest &forest) {
+/* Maximum scenic score in a single sweep down the rows of by_row. The
+ * monotonic stacks give the left and right distances of each row, and a
+ * summary per column finishes the scores, so the extra memory only grows
+ * with the width. */
+  int rows = forest.rows;
+  int cols = forest.cols;
+  std::vector<column_summary> columns(cols);
+  std::vector<int> left(cols), right(cols), stack;
+  long long best = 0;
+  for (int irow = 0; irow < rows; irow++) {
+    const std::uint8_t *line = &forest.by_row[std::size_t(irow) * cols];
+    line_view_dists(cols, [&](int i) { return line[i]; }, left, stack);
+    line_view_dists(cols, [&](int i) { return line[cols - 1 - i]; },
+                    right, stack);
+    for (int icol = 0; icol < cols; icol++) {
+      long long side_score = (long long) left[icol] * right[cols - 1 - icol];
+      best = std::max(best, columns[icol].add_tree(irow, line[icol], true,
+                                                   side_score));
+    }
+  }
+  long long nvisible = 0; // Unused: every tree was marked counted.
+  for (auto &col : columns) {
+    best = std::max(best, col.finish(rows, nvisible));
+  }
+  return best;
+}
+
+/* Vectorized visibility probes
+ * Lines of the grid are swept one after the other, with a running maximum
+ * per position across the line, 32 positions per AVX2 instruction. The
+ * sweep over a block of 32 positions stops once all of them have seen a
+ * tree of height 9. Left and right probes run on the transposed copy. */
+template <typename visible_fn>
+void probe_lines_simd (const std::uint8_t *grid, int nlines, int width,
+                       bool forward, visible_fn mark_visible) {
+/* mark_visible(line, pos0, mask): bit b of mask set when the tree at
+ * (line, pos0 + b) is taller than all those before it in the sweep. */
+  int pos0 = 0;
+#ifdef __AVX2__
+  const __m256i nine = _mm256_set1_epi8(9);
+  for (; pos0 + 32 <= width; pos0 += 32) {
+    __m256i max_heights = _mm256_set1_epi8(-1);
+    for (int i = 0; i < nlines; i++) {
+      int line = forward ? i : nlines - 1 - i;
+      __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                      grid + std::size_t(line) * width + pos0));
+      __m256i taller = _mm256_cmpgt_epi8(cur, max_heights);
+      std::uint32_t mask = _mm256_movemask_epi8(taller);
+      if (mask) {
+        mark_visible(line, pos0, mask);
+        max_heights = _mm256_max_epi8(cur, max_heights);
+        std::uint32_t all_nine = _mm256_movemask_epi8(
+                                   _mm256_cmpeq_epi8(max_heights, nine));
+        if (all_nine == 0xFFFFFFFFu) { break; }
+      }
+    }
+  }
+#endif
+  for (; pos0 < width; pos0 += 32) { // Scalar remainder.
+    int block = std::min(32, width - pos0);
+    std::vector<int> max_heights(block, -1);
+    for (int i = 0; i < nlines; i++) {
+      int line = forward ? i : nlines - 1 - i;
+      const std::uint8_t *cur = grid + std::size_t(line) * width + pos0;
+      std::uint32_t mask = 0;
+      for (int b = 0; b < block; b++) {
+        if (cur[b] > max_heights[b]) {
+          max_heights[b] = cur[b];
+          mask |= std::uint32_t(1) << b;
+        }
+      }
+      if (mask) { mark_visible(line, pos0, mask); }
+    }
+  }
+}
+
+bit_map compute_visibility_simd (const packed_forest &forest) {
+/* Same visibility as compute_visibility_packed. */
+  bit_map visibs(forest.rows, forest.cols);
+  auto mark_rows = [&visibs](int irow, int icol0, std::uint32_t mask) {
+    visibs.set_bits(irow, icol0, mask);
+  };
+  auto mark_cols = [&visibs](int icol, int irow0, std::uint32_t mask) {
+    // Few trees are visible from the sides: set them one by one.
+    while (mask) {
+      visibs.set(irow0 + __builtin_ctz(mask), icol);
+      mask &= mask - 1;
+    }
+  };
+  probe_lines_simd(forest.by_row.data(), forest.rows, forest.cols, true,
+                   mark_rows); // Top.
+  probe_lines_simd(forest.by_row.data(), forest.rows, forest.cols, false,
+                   mark_rows); // Bottom.
+  probe_lines_simd(forest.by_col.data(), forest.cols, forest.rows, true,
+                   mark_cols); // Left.
+  probe_lines_simd(forest.by_col.data(), forest.cols, forest.rows, false,
+                   mark_cols); // Right.
+  return visibs;
+}
+
+/* Multi-threaded visibility and scenic scores by bands */
+template <typename band_fn>
+void run_bands (int n, int nthreads, int align, band_fn work) {
+/* Split [0, n) in one band per thread, with boundaries on multiples of
+ * align, and run work(begin, end, ithread) for each band in parallel. */
+  int band = (n + nthreads - 1) / nthreads;
+  band = (band + align - 1) / align * align;
+  std::vector<std::thread> pool;
+  for (int ithread = 0; ithread < nthreads; ithread++) {
+    int begin = std::min(n, ithread * band);
+    int end = std::min(n, begin + band);
+    if (begin < end) { pool.emplace_back(work, begin, end, ithread); }
+  }
+  for (auto &t : pool) { t.join(); }
+}
+
+int word_align (int line_len) {
+/* Number of lines of a bit map that fill whole 64-bit words: bands made
+ * of such lines never share a word. */
+  int g = 64;
+  while (line_len % g != 0) { g /= 2; }
+  return 64 / g;
+}
+
+long long count_visible_parallel (const packed_forest &forest,
+                                  int nthreads) {
+/* Number of visible trees. Left and right probes mark a row-major map by
+ * row bands. Top and bottom probes mark a column-major map by column
+ * bands, on the transposed copy. The count is the size of the union of
+ * the two maps, summed per band and reduced at the end. */
+  int rows = forest.rows;
+  int cols = forest.cols;
+  bit_map from_sides(rows, cols);
+  bit_map from_ends(cols, rows); // Indexed (column, row).
+  std::vector<long long> partial(nthreads, 0);
+
+  run_bands(rows, nthreads, word_align(cols),
+            [&](int row0, int row1, int) {
+    for (int irow = row0; irow < row1; irow++) {
+      probe_line_sides(&forest.by_row[std::size_t(irow) * cols], cols, irow,
+                       from_sides);
+    }
+  });
+  run_bands(cols, nthreads, word_align(rows),
+            [&](int col0, int col1, int) {
+    for (int icol = col0; icol < col1; icol++) {
+      probe_line_sides(&forest.by_col[std::size_t(icol) * rows], rows, icol,
+                       from_ends);
+    }
+  });
+  run_bands(rows, nthreads, word_align(cols),
+            [&](int row0, int row1, int ithread) {
+    // Trees seen from the sides, counted once.
+    std::size_t word0 = std::size_t(row0) * cols / 64;
+    std::size_t word1 = (std::size_t(row1) * cols + 63) / 64;
+    long long count = 0; // Local: partial shares cache lines.
+    for (std::size_t iword = word0; iword < word1; iword++) {
+      count += __builtin_popcountll(from_sides.words[iword]);
+    }
+    partial[ithread] += count;
+  });
+  run_bands(cols, nthreads, word_align(rows),
+            [&](int col0, int col1, int ithread) {
+    // Trees seen from the ends only. These are sparse: walk the set bits.
+    std::size_t word0 = std::size_t(col0) * rows / 64;
+    std::size_t word1 = (std::size_t(col1) * rows + 63) / 64;
+    long long count = 0;
+    for (std::size_t iword = word0; iword < word1; iword++) {
+      std::uint64_t word = from_ends.words[iword];
+      while (word) {
+        std::size_t ibit = iword * 64 + __builtin_ctzll(word);
+        word &= word - 1;
+        if (not from_sides.get(ibit % rows, ibit / rows)) { count++; }
+      }
+    }
+    partial[ithread] += count;
+  });
+  return std::accumulate(partial.begin(), partial.end(), 0LL);
+}
+
+long long max_scenic_score_parallel (const packed_forest &forest,
+                                     int nthreads) {
+/* Maximum scenic score, down the rows by blocks. Row bands compute the
+ * left and right view distances of a block of rows. Column bands then pass
+ * them to the column summaries, as in max_scenic_score_packed. Only the
+ * side scores of one block are kept, about a million trees. */
+  int rows = forest.rows;
+  int cols = forest.cols;
+  std::vector<column_summary> columns(cols);
+  int block_rows = std::max(1, (1 << 20) / std::max(1, cols));
+  std::vector<long long> side_scores(std::size_t(std::min(rows, block_rows))
+                                     * cols);
+  std::vector<long long> partial(nthreads, 0);
+
+  for (int block0 = 0; block0 < rows; block0 += block_rows) {
+    int block1 = std::min(rows, block0 + block_rows);
+    run_bands(block1 - block0, nthreads, 1, [&](int row0, int row1, int) {
+      std::vector<int> left(cols), right(cols), stack;
+      for (int irow = row0; irow < row1; irow++) {
+        const std::uint8_t *line =
+          &forest.by_row[std::size_t(block0 + irow) * cols];
+        line_view_dists(cols, [&](int i) { return line[i]; }, left, stack);
+        line_view_dists(cols, [&](int i) { return line[cols - 1 - i]; },
+                        right, stack);
+        for (int icol = 0; icol < cols; icol++) {
+          side_scores[std::size_t(irow) * cols + icol] =
+            (long long) left[icol] * right[cols - 1 - icol];
+        }
+      }
+    });
+    run_bands(cols, nthreads, 1, [&](int col0, int col1, int ithread) {
+      long long best = partial[ithread]; // Local: partial shares cache lines.
+      for (int irow = block0; irow < block1; irow++) {
+        const std::uint8_t *line = &forest.by_row[std::size_t(irow) * cols];
+        const long long *line_scores =
+          &side_scores[std::size_t(irow - block0) * cols];
+        for (int icol = col0; icol < col1; icol++) {
+          best = std::max(best, columns[icol].add_tree(irow, line[icol], true,
+                                                       line_scores[icol]));
+        }
+      }
+      partial[ithread] = best;
+    });
+  }
+  long long best = 0;
+  long long nvisible = 0; // Unused: every tree was marked counted.
+  for (auto &col : columns) {
+    best = std::max(best, col.finish(rows, nvisible));
+  }
+  return std::max(best, *std::max_element(partial.begin(), partial.end()));
+}
+
+/* Live forest: answers kept current when tree heights change */
+class live_forest {
+/* Keeps, for every tree, the sides it is seen from and the products of
+ * its row and column view distances. Changing the height at (r, c) only
+ * changes these along row r and column c: both lines are swept again, in
+ * O(rows + cols). The visible count is adjusted on the way, and a max
+ * segment tree over the scenic scores is updated for the changed trees. */
+  public:
+    int rows = 0;
+    int cols = 0;
+    std::vector<std::uint8_t> heights; // Row-major.
+    long long nvisible = 0;
+
+    live_forest (packed_forest &&forest); // Takes the row-major heights.
+
+    void set_height (int irow, int icol, int height);
+    long long max_scenic_score () const;
+
+  private:
+    enum side : std::uint8_t { left = 1, right = 2, top = 4, bottom = 8 };
+    std::vector<std::uint8_t> seen_from; // Bit field of side values.
+    std::vector<long long> row_prod; // Left * right view distances.
+    std::vector<long long> col_prod; // Up * down view distances.
+    std::vector<long long> max_tree; // Leaves at [ncells, 2 * ncells).
+    std::vector<int> dists_fwd, dists_bwd, stack; // Sweep buffers.
+    std::vector<std::uint8_t> line_sides;
+
+    std::size_t cell (int irow, int icol) const {
+      return std::size_t(irow) * cols + icol;
+    }
+    template <typename cell_fn>
+    void sweep_line (int len, cell_fn cell_at, std::uint8_t fwd_side,
+                     std::uint8_t bwd_side, std::vector<long long> &prod);
+    void sweep_row (int irow);
+    void sweep_col (int icol);
+    void update_score (std::size_t icell);
+};
+
+live_forest::live_forest (packed_forest &&forest) {
+  rows = forest.rows;
+  cols = forest.cols;
+  heights = std::move(forest.by_row);
+  std::size_t ncells = heights.size();
+  seen_from.assign(ncells, 0);
+  row_prod.assign(ncells, 0);
+  col_prod.assign(ncells, 0);
+  dists_fwd.resize(std::max(rows, cols));
+  dists_bwd.resize(std::max(rows, cols));
+  line_sides.resize(std::max(rows, cols));
+  for (int irow = 0; irow < rows; irow++) { sweep_row(irow); }
+  for (int icol = 0; icol < cols; icol++) { sweep_col(icol); }
+  max_tree.assign(2 * ncells, 0);
+  for (std::size_t icell = 0; icell < ncells; icell++) {
+    max_tree[ncells + icell] = row_prod[icell] * col_prod[icell];
+  }
+  for (std::size_t inode = ncells - 1; inode >= 1 and inode < ncells;
+       inode--) {
+    max_tree[inode] = std::max(max_tree[2 * inode], max_tree[2 * inode + 1]);
+  }
+}
+
+template <typename cell_fn>
+void live_forest::sweep_line (int len, cell_fn cell_at,
+                              std::uint8_t fwd_side, std::uint8_t bwd_side,
+                              std::vector<long long> &prod) {
+/* Visibility from both ends of a line and view distance products along
+ * it. cell_at(i) is the index of the i-th tree of the line. */
+  auto height_fwd = [&](int i) { return heights[cell_at(i)]; };
+  auto height_bwd = [&](int i) { return heights[cell_at(len - 1 - i)]; };
+  line_view_dists(len, height_fwd, dists_fwd, stack);
+  line_view_dists(len, height_bwd, dists_bwd, stack);
+  int max_height = -1;
+  for (int i = 0; i < len; i++) {
+    line_sides[i] = 0;
+    if (height_fwd(i) > max_height) {
+      max_height = height_fwd(i);
+      line_sides[i] = fwd_side;
+    }
+  }
+  max_height = -1;
+  for (int i = len - 1; i >= 0; i--) {
+    if (height_fwd(i) > max_height) {
+      max_height = height_fwd(i);
+      line_sides[i] |= bwd_side;
+    }
+  }
+  for (int i = 0; i < len; i++) {
+    std::size_t icell = cell_at(i);
+    std::uint8_t sides = (seen_from[icell] & ~(fwd_side | bwd_side))
+                         | line_sides[i];
+    nvisible += (sides != 0) - (seen_from[icell] != 0);
+    seen_from[icell] = sides;
+    prod[icell] = (long long) dists_fwd[i] * dists_bwd[len - 1 - i];
+  }
+}
+
+void live_forest::sweep_row (int irow) {
+  sweep_line(cols, [&](int i) { return cell(irow, i); }, left, right,
+             row_prod);
+}
+
+void live_forest::sweep_col (int icol) {
+  sweep_line(rows, [&](int i) { return cell(i, icol); }, top, bottom,
+             col_prod);
+}
+
+void live_forest::update_score (std::size_t icell) {
+  std::size_t inode = heights.size() + icell;
+  max_tree[inode] = row_prod[icell] * col_prod[icell];
+  for (inode /= 2; inode >= 1; inode /= 2) {
+    max_tree[inode] = std::max(max_tree[2 * inode], max_tree[2 * inode + 1]);
+  }
+}
+
+void live_forest::set_height (int irow, int icol, int height) {
+/* Change one tree height and repair the answers. */
+  heights[cell(irow, icol)] = height;
+  sweep_row(irow);
+  sweep_col(icol);
+  for (int i = 0; i < cols; i++) { update_score(cell(irow, i)); }
+  for (int i = 0; i < rows; i++) { update_score(cell(i, icol)); }
+}
+
+long long live_forest::max_scenic_score () const {
+  return max_tree.empty() ? 0 : max_tree[1];
+}
+
+/* Out-of-core tiled engine
+ * Streams the input file by tiles of whole rows, each mapped on its own
+ * and released after use, so memory only depends on the tile size and
+ * the width. Rows are complete inside a tile: left and right views are
+ * solved in place. Columns go through all tiles, each carrying its
+ * column_summary between tiles. */
+bool solve_out_of_core (const std::string &path, std::size_t tile_bytes,
+                        long long &nvisible, long long &max_score) {
+/* Visible tree count and maximum scenic score of the forest in the file,
+ * in one pass over it, with bounded memory. */
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "Cannot open " << path << std::endl;
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  std::size_t size = st.st_size;
+
+  // Row width: position of the first newline.
+  std::size_t width = 0;
+  std::vector<char> probe(1 << 16);
+  bool found_newline = false;
+  while (not found_newline and width < size) {
+    ssize_t nread = pread(fd, probe.data(), probe.size(), width);
+    if (nread <= 0) { break; }
+    auto newline = std::find(probe.begin(), probe.begin() + nread, '\n');
+    width += newline - probe.begin();
+    found_newline = (newline != probe.begin() + nread);
+  }
+  std::size_t stride = width + 1;
+  if (width > 0 and found_newline) {
+    char last_char;
+    if (pread(fd, &last_char, 1, width - 1) == 1 and last_char == '\r') {
+      width--; // CRLF input.
+    }
+  }
+  // Rows may outnumber int at this scale, for narrow forests.
+  long long rows = (width == 0) ? 0
+                   : size / stride + ((size % stride) >= width ? 1 : 0);
+  int cols = width;
+  if (width > 0 and size % stride != 0 and size % stride < width) {
+    std::cerr << "Truncated last row in " << path << std::endl;
+    close(fd);
+    return false;
+  }
+
+  nvisible = 0;
+  max_score = 0;
+  std::vector<column_summary> columns(cols);
+  std::vector<std::uint8_t> heights(cols); // Current row.
+  std::vector<int> left(cols), right(cols), stack;
+  std::vector<bool> seen_side(cols);
+  std::size_t page = sysconf(_SC_PAGESIZE);
+  long long tile_rows = std::max<std::size_t>(1, tile_bytes / stride);
+
+  for (long long row0 = 0; row0 < rows; row0 += tile_rows) {
+    long long row1 = std::min(rows, row0 + tile_rows);
+    std::size_t begin = std::size_t(row0) * stride;
+    std::size_t end = std::min(size, std::size_t(row1) * stride);
+    std::size_t map_begin = begin / page * page;
+    void *map = mmap(nullptr, end - map_begin, PROT_READ, MAP_PRIVATE, fd,
+                     map_begin);
+    if (map == MAP_FAILED) {
+      std::cerr << "Cannot map " << path << std::endl;
+      close(fd);
+      return false;
+    }
+    const char *tile = static_cast<const char *>(map) + (begin - map_begin);
+
+    for (long long irow = row0; irow < row1; irow++) {
+      const char *line = tile + std::size_t(irow - row0) * stride;
+      if (irow + 1 < rows and line[stride - 1] != '\n') {
+        std::cerr << "Rows of different widths in " << path << std::endl;
+        munmap(map, end - map_begin);
+        close(fd);
+        return false;
+      }
+      if (not digits_to_heights(line, heights.data(), cols)) {
+        std::cerr << "Non-digit height on row " << irow << " of " << path
+                  << std::endl;
+        munmap(map, end - map_begin);
+        close(fd);
+        return false;
+      }
+      auto height_at = [&heights](int i) { return int(heights[i]); };
+      line_view_dists(cols, height_at, left, stack);
+      line_view_dists(cols, [&](int i) { return height_at(cols - 1 - i); },
+                      right, stack);
+      std::fill(seen_side.begin(), seen_side.end(), false);
+      int max_height = -1;
+      for (int icol = 0; (icol < cols and max_height < 9); icol++) {
+        if (height_at(icol) > max_height) {
+          max_height = height_at(icol);
+          seen_side[icol] = true;
+        }
+      }
+      max_height = -1;
+      for (int icol = cols - 1; (icol >= 0 and max_height < 9); icol--) {
+        if (height_at(icol) > max_height) {
+          max_height = height_at(icol);
+          seen_side[icol] = true;
+        }
+      }
+
+      for (int icol = 0; icol < cols; icol++) {
+        column_summary &col = columns[icol];
+        int h = height_at(icol);
+        bool counted = seen_side[icol] or h > col.top_max;
+        col.top_max = std::max(col.top_max, h);
+        if (counted) { nvisible++; }
+
+        long long side_score = (long long) left[icol] * right[cols - 1 - icol];
+        max_score = std::max(max_score, col.add_tree(irow, h, counted,
+                                                     side_score));
+      }
+    }
+    munmap(map, end - map_begin);
+  }
+  close(fd);
+
+  for (auto &col : columns) {
+    max_score = std::max(max_score, col.finish(rows, nvisible));
+  }
+  return true;
+}
+
+int solve_packed (packed_forest &forest, const std::string &mode,
+                  const std::string &mode_arg) {
+/* Answers on the packed forest, for the modes that use it. The extra
+ * argument is the updates file, or the thread count for --parallel. */
+  if (mode == "--updates") {
+    /* Height changes, one "row col height" line each */
+    live_forest live(std::move(forest));
+    std::ifstream updates(mode_arg);
+    int irow, icol, height;
+    while (updates >> irow >> icol >> height) {
+      if (irow < 0 or irow >= live.rows or icol < 0 or icol >= live.cols
+          or height < 0 or height > 9) {
+        std::cerr << "Invalid update: " << irow << " " << icol << " "
+                  << height << std::endl;
+        return 1;
+      }
+      live.set_height(irow, icol, height);
+    }
+    std::cout << "Visible trees: " << live.nvisible << std::endl;
+    std::cout << "Maximum scenic score: " << live.max_scenic_score()
+              << std::endl;
+    return 0;
+  }
+
+  if (mode == "--parallel") {
+    /* Bands of rows and columns on every core */
+    int nthreads = mode_arg.empty()
+                   ? std::max(1u, std::thread::hardware_concurrency())
+                   : std::stoi(mode_arg);
+    if (nthreads < 1) {
+      std::cerr << "The thread count must be positive." << std::endl;
+      return 1;
+    }
+    forest.transpose(); // Column bands read the column-major copy.
+    auto start = std::chrono::steady_clock::now();
+    long long nvis = count_visible_parallel(forest, nthreads);
+    long long max_score = max_scenic_score_parallel(forest, nthreads);
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    std::cout << "Visible trees: " << nvis << std::endl;
+    std::cout << "Maximum scenic score: " << max_score << std::endl;
+    std::cout << "Threads: " << nthreads << ", time: " << elapsed.count()
+              << " s" << std::endl;
+    return 0;
+  }
+
+  /* Byte heights and bit visibility */
+  if (mode == "--simd") { forest.transpose(); } // Left and right probes.
+  auto visibs = (mode == "--simd") ? compute_visibility_simd(forest)
+                                   : compute_visibility_packed(forest);
+  std::cout << "Visible trees: " << visibs.count() << std::endl;
+  std::cout << "Maximum scenic score: " << max_scenic_score_packed(forest)
+            << std::endl;
+  return 0;
+}
+
 int main (int argc, char *argv[]) {
   std::cout << "# Day 8#" << std::endl;
 
-  if (argc != 2) {
+  if (argc < 2 or argc > 4) {
     std::cerr << "Please provide the input file." << std::endl;
+    std::cerr << "Usage: day8 <input> [--naive | --packed | --simd"
+              << " | --parallel [threads] | --updates <file>"
+              << " | --top <K> (pruned search, not always faster)"
+              << " | --out-of-core [tile MB]]" << std::endl;
     return 1;
   }
+  std::string mode = (argc >= 3) ? argv[2] : "";
+
+  if (mode == "--out-of-core") {
+    /* Forests larger than memory, streamed by tiles */
+    std::size_t tile_mb = (argc == 4) ? std::stoul(argv[3]) : 64;
+    long long nvis, max_score;
+    if (not solve_out_of_core(argv[1], tile_mb << 20, nvis, max_score)) {
+      return 1;
+    }
+    std::cout << "Visible trees: " << nvis << std::endl;
+    std::cout << "Maximum scenic score: " << max_score << std::endl;
+    return 0;
+  }
+
+  if (mode == "--updates" or mode == "--parallel" or mode == "--packed"
+      or mode == "--simd") {
+    /* Byte heights, mapped straight from the input file */
+    packed_forest forest;
+    if (not forest.load_mapped(argv[1])) { return 1; }
+    return solve_packed(forest, mode, (argc == 4) ? argv[3] : "");
+  }
 
   /* Parsing the input text */
   std::ifstream input(argv[1]);
   auto str_vec = parse_input(input);
   auto heights = parse_height_map(str_vec);
 
+  if (mode == "--top" and argc == 4) {
+    /* Only the best few scenic spots */
+    for (auto spot : top_scenic_spots(heights, std::stoi(argv[3]))) {
+      std::cout << "Scenic score " << spot.score << " at (" << spot.row
+                << ", " << spot.col << ")" << std::endl;
+    }
+    return 0;
+  }
+
   /* Probing for visible trees */
   auto visibs = compute_visibility_map(heights);
   
@@ -203,7 +1249,9 @@ int main (int argc, char *argv[]) {
   std::cout << "Visible trees: " << nvis << std::endl;
 
   /* Computing the scenic score for every tree */
-  auto scenic_scores = compute_scenic_scores(heights);
+  auto scenic_scores = (mode == "--naive")
+                       ? compute_scenic_scores(heights)
+                       : compute_scenic_scores_stack(heights);
   std::cout << "Maximum scenic score: " << scenic_scores.maxCoeff()
             << std::endl;
 }
@@ -6,6 +6,10 @@
 #include <numeric>
 #include <functional>
 #include <utility>
+#include <unordered_map>
+#include <array>
+#include <cstdint>
+#include <type_traits>
 
 #include <boost/functional/hash.hpp>
 
@@ -56,31 +60,102 @@ move parse_moveline (const std::string &line) {
   return move(dir, steps);
 }
 
-/* Head and Tail knots state class */
+/* Visit sets
+ * Record the positions visited by the tail. They all provide mark(pos)
+ * and size(), the number of distinct positions marked. */
 typedef std::unordered_map<pos, int, pos::hash_function> pos_counts_map;
 
-class knots_state {
+struct hash_visits {
+/* Visit counts in a hash map */
+  pos_counts_map counts;
+
+  void mark (const pos &_pos) { counts[_pos]++; }
+  std::size_t size () const { return counts.size(); }
+};
+
+/* Bounding box of the positions reached by the head */
+struct pos_bounds {
+  long long row_min = 0, row_max = 0;
+  long long col_min = 0, col_max = 0;
+
+  long long nrows () const { return row_max - row_min + 1; }
+  long long ncols () const { return col_max - col_min + 1; }
+};
+
+pos_bounds head_bounds (const std::vector<move> &moves) {
+/* Pre-scan the moves for the bounding box of the head. Every other knot
+ * only ever steps towards the one before it, so it stays in the box. */
+  pos_bounds bounds;
+  long long row = 0, col = 0;
+  for (auto &m : moves) {
+    switch (m.dir) {
+      case 'L': col -= m.steps; break;
+      case 'R': col += m.steps; break;
+      case 'U': row += m.steps; break;
+      case 'D': row -= m.steps; break;
+    }
+    bounds.row_min = std::min(bounds.row_min, row);
+    bounds.row_max = std::max(bounds.row_max, row);
+    bounds.col_min = std::min(bounds.col_min, col);
+    bounds.col_max = std::max(bounds.col_max, col);
+  }
+  return bounds;
+}
+
+class dense_visits {
+/* One bit per position of a known bounding box */
   public:
-  pos head = pos(0, 0);
-  pos tail = pos(0, 0);
-  pos_counts_map visits;
+  dense_visits (const pos_bounds &bounds)
+    : row_min(bounds.row_min), col_min(bounds.col_min),
+      ncols(bounds.ncols()),
+      words((bounds.nrows() * bounds.ncols() + 63) / 64, 0) {}
+
+  void mark (const pos &_pos) {
+    std::uint64_t ibit = (_pos.row - row_min) * ncols + (_pos.col - col_min);
+    words[ibit / 64] |= std::uint64_t(1) << (ibit % 64);
+  }
+
+  std::size_t size () const {
+    std::size_t nset = 0;
+    for (auto w : words) { nset += __builtin_popcountll(w); }
+    return nset;
+  }
 
-  knots_state ();
-  void process_move (const move &_move);
-  
   private:
-  pos move_to_pos (const move &_move); // Convert the move direction to a delta pos.
-  bool tail_mustmove ();
-  void update_head (const pos &dpos); // Update the head position.
-  void update_tail (); // Update the tail position.
-  void note_visited (); // Update the tail visit map.
+  long long row_min, col_min, ncols;
+  std::vector<std::uint64_t> words;
 };
 
-knots_state::knots_state () {
-  note_visited();
-}
+class sparse_visits {
+/* Bitmap of 64x64 tiles, allocated when first reached */
+  public:
+  void mark (const pos &_pos) {
+    std::uint64_t key = (std::uint64_t(std::uint32_t(_pos.row >> 6)) << 32)
+                        | std::uint32_t(_pos.col >> 6);
+    if (last_tile == nullptr or key != last_key) { // Steps stay in a tile.
+      last_tile = &tiles[key];
+      last_key = key;
+    }
+    (*last_tile)[_pos.row & 63] |= std::uint64_t(1) << (_pos.col & 63);
+  }
+
+  std::size_t size () const {
+    std::size_t nset = 0;
+    for (auto &tile : tiles) {
+      for (auto w : tile.second) { nset += __builtin_popcountll(w); }
+    }
+    return nset;
+  }
 
-pos knots_state::move_to_pos (const move &_move) {
+  private:
+  typedef std::array<std::uint64_t, 64> tile_bits;
+  std::unordered_map<std::uint64_t, tile_bits> tiles;
+  tile_bits *last_tile = nullptr; // Node pointers survive rehashing.
+  std::uint64_t last_key = 0;
+};
+
+pos move_to_pos (const move &_move) {
+/* Convert the move direction to a single step */
   switch (_move.dir) {
     case 'L': return pos(0, -1); break;
     case 'R': return pos(0, 1); break;
@@ -92,140 +167,135 @@ pos knots_state::move_to_pos (const move &_move) {
   }
 }
 
-void knots_state::update_head (const pos &dpos) {
-/* Update the head position by a single step */
-  head.row += dpos.row;
-  head.col += dpos.col;
-}
-
-bool knots_state::tail_mustmove () {
-/* Indicate whether the tail position must move */
-  int drow = std::abs(head.row - tail.row);
-  int dcol = std::abs(head.col - tail.col);
-  int dmax = std::max(drow, dcol);
-  return (dmax >= 2);
-}
-
-void knots_state::update_tail () {
-/* Update the tail position in relation with the head position */
-  if (tail_mustmove()) {
-    int drow = head.row - tail.row;
-    int dcol = head.col - tail.col;
-    if (drow != 0) { tail.row += drow / std::abs(drow); }
-    if (dcol != 0) { tail.col += dcol / std::abs(dcol); }
-  }
-}
-
-void knots_state::note_visited () {
-/* Update the visits map with the current tail position */
-  visits[tail]++;
-}
-
-void knots_state::process_move (const move &_move) {
-/* Process a single move line */
-  pos dpos = move_to_pos(_move); // Single update step.
-  for (int istep = 0; istep < _move.steps; istep++) {
-    update_head(dpos);
-    update_tail();
-    note_visited();
-  }
-}
+inline int sign (int x) { return (x > 0) - (x < 0); }
 
+/* Rope of knots
+ * The knot count is a template parameter so that the knots live in a
+ * std::array and the pull loop has a constant trip count. nknots = 0
+ * selects a std::vector sized at run time, for arbitrary lengths. */
+template <int nknots, typename visit_set>
 class rope {
   public:
+  typedef typename std::conditional<nknots == 0, std::vector<pos>,
+                                    std::array<pos, nknots>>::type knot_list;
   // The front knot is the head. The back knot is the tail.
-  std::vector<pos> knots;
-  pos_counts_map visits;
+  knot_list knots;
+  visit_set visits;
 
-  std::vector<pos> init_knots ();
-
-  rope ();
+  rope (visit_set _visits = visit_set(), int length = nknots);
   void process_move (const move &_move);
-  
+
   private:
-  pos move_to_pos (const move &_move); // Convert the move direction to a delta pos.
-  bool knot_mustmove (const int iknot);
-  void update_head (const pos &dpos); // Update the head position.
-  void update_knot (const int iknot); // Update the tail position.
-  void note_visited (); // Update the tail visit map.
+  bool pull_knots (); // Pull the knots after the head, true if the tail moved.
 };
 
-std::vector<pos> rope::init_knots () {
-/* Initial set of knots */
-  std::vector<pos> initial_knots;
-  for (int iknot = 0; iknot < 10; iknot++) {
-    initial_knots.push_back(pos());
-  }
-  return initial_knots;
+template <int nknots, typename visit_set>
+rope<nknots, visit_set>::rope (visit_set _visits, int length)
+  : visits(std::move(_visits)) {
+  if constexpr (nknots == 0) { knots.resize(length); }
+  visits.mark(knots.back());
 }
 
-rope::rope () {
-  knots = init_knots();
-  note_visited();
+template <int nknots, typename visit_set>
+bool rope<nknots, visit_set>::pull_knots () {
+/* Each knot steps towards the preceding one when they are no longer
+ * touching. A knot that stays in place leaves the rest of the rope in
+ * place too, which ends the update early. */
+  for (std::size_t iknot = 1; iknot < knots.size(); iknot++) {
+    int drow = knots[iknot - 1].row - knots[iknot].row;
+    int dcol = knots[iknot - 1].col - knots[iknot].col;
+    if (std::max(std::abs(drow), std::abs(dcol)) < 2) { return false; }
+    knots[iknot].row += sign(drow);
+    knots[iknot].col += sign(dcol);
+  }
+  return true;
 }
 
-pos rope::move_to_pos (const move &_move) {
-  switch (_move.dir) {
-    case 'L': return pos(0, -1); break;
-    case 'R': return pos(0, 1); break;
-    case 'U': return pos(1, 0); break;
-    case 'D': return pos(-1, 0); break;
-    default:
-      std::cerr << "Move direction unrecognized." << std::endl;
-      return pos(0,0);
+template <int nknots, typename visit_set>
+void rope<nknots, visit_set>::process_move (const move &_move) {
+/* Process a single move line */
+  pos dpos = move_to_pos(_move); // Single update step.
+  for (int istep = 0; istep < _move.steps; istep++) {
+    knots.front().row += dpos.row;
+    knots.front().col += dpos.col;
+    if (pull_knots()) { visits.mark(knots.back()); }
   }
 }
 
-void rope::update_head (const pos &dpos) {
-/* Update the head position by a single step */
-  knots.front().row += dpos.row;
-  knots.front().col += dpos.col;
+template <int nknots, typename visits_maker>
+std::size_t run_rope (const std::vector<move> &moves,
+                      const visits_maker &make_visits, int length = nknots) {
+/* Number of positions visited by the tail of the rope. Its visit set is
+ * made here and moved into the rope, never copied. */
+  typedef decltype(make_visits()) visit_set;
+  rope<nknots, visit_set> r(make_visits(), length);
+  for (auto &m : moves) {
+    r.process_move(m);
+  }
+  return r.visits.size();
 }
 
-bool rope::knot_mustmove (const int iknot) {
-/* Indicate whether the knot at position iknot must move. */
-  int drow = std::abs(knots.at(iknot - 1).row - knots.at(iknot).row);
-  int dcol = std::abs(knots.at(iknot - 1).col - knots.at(iknot).col);
-  int dmax = std::max(drow, dcol);
-  return (dmax >= 2);
+template <typename visits_maker>
+std::size_t tail_visits (const std::vector<move> &moves, int length,
+                         const visits_maker &make_visits) {
+/* Dispatch the rope length to its instantiation, or to the run-time
+ * sized rope for uncommon lengths. */
+  switch (length) {
+    case 1: return run_rope<1>(moves, make_visits);
+    case 2: return run_rope<2>(moves, make_visits);
+    case 3: return run_rope<3>(moves, make_visits);
+    case 4: return run_rope<4>(moves, make_visits);
+    case 5: return run_rope<5>(moves, make_visits);
+    case 10: return run_rope<10>(moves, make_visits);
+    default: return run_rope<0>(moves, make_visits, length);
+  }
 }
 
-void rope::update_knot (const int iknot) {
-/* Update the knot at position iknot in relation with the
- * preceding knot. */
-  if (knot_mustmove(iknot)) {
-    int drow = knots.at(iknot - 1).row - knots.at(iknot).row;
-    int dcol = knots.at(iknot - 1).col - knots.at(iknot).col;
-    if (drow != 0) { knots.at(iknot).row += drow / std::abs(drow); }
-    if (dcol != 0) { knots.at(iknot).col += dcol / std::abs(dcol); }
+template <typename visits_maker>
+void solve (const std::vector<move> &moves, const visits_maker &make_visits,
+            int length) {
+/* Both parts, recording visits in the sets returned by make_visits(). A
+ * given rope length replaces them. */
+  if (length > 0) {
+    std::cout << "Rope of " << length << " knots: "
+              << "number of locations visited by the tail: "
+              << tail_visits(moves, length, make_visits) << std::endl;
+    return;
   }
-}
 
-void rope::note_visited () {
-/* Update the visits map with the current tail position */
-  visits[knots.back()]++;
-}
+  /* Part 1 */
+  std::cout << "Number of locations visited by tail: "
+            << tail_visits(moves, 2, make_visits) << std::endl;
 
-void rope::process_move (const move &_move) {
-/* Process a single move line */
-  pos dpos = move_to_pos(_move); // Single update step.
-  for (int istep = 0; istep < _move.steps; istep++) {
-    update_head(dpos);
-    for (int iknot = 1; iknot < int(knots.size()); iknot ++) {
-      update_knot(iknot);
-    }
-    note_visited();
-  }
+  /* Part 2 */
+  std::cout << "Rope case: number of locations visited by the tail: "
+            << tail_visits(moves, 10, make_visits) << std::endl;
 }
 
 int main (int argc, char *argv[]) {
   std::cout << "# Day 9#" << std::endl;
 
 
-  if (argc != 2) {
+  if (argc < 2 or argc > 5) {
     std::cerr << "Please provide the input file." << std::endl;
+    std::cerr << "Usage: day9 <input> [--bitmap | --sparse] [--knots <N>]"
+              << std::endl;
     return 1;
   }
+  std::string mode;
+  int length = 0; // Both parts by default.
+  for (int iarg = 2; iarg < argc; iarg++) {
+    std::string arg = argv[iarg];
+    if (arg == "--knots" and iarg + 1 < argc) {
+      length = std::stoi(argv[++iarg]);
+      if (length < 1) {
+        std::cerr << "The rope needs at least one knot." << std::endl;
+        return 1;
+      }
+    } else {
+      mode = arg;
+    }
+  }
 
   /* Parsing the input text */
   std::ifstream input(argv[1]);
@@ -235,23 +305,19 @@ int main (int argc, char *argv[]) {
     moves.push_back(parse_moveline(line));
   }
 
-  /* Part 1 */
-  knots_state ks;
-
-  for(auto m : moves) {
-    ks.process_move(m);
-  }
-
-  std::cout << "Number of locations visited by tail: "
-            << ks.visits.size() << std::endl;
-
-  /* Part 2 */
-  rope r;
-
-  for(auto m : moves) {
-    r.process_move(m);
+  if (mode == "--bitmap" or mode == "--sparse") {
+    /* Visits in bitmaps: dense over the head's bounding box when it is
+     * small enough, else by tiles allocated on demand. */
+    const long long max_dense_bits = 1LL << 32;
+    pos_bounds bounds = head_bounds(moves);
+    if (mode == "--bitmap"
+        and bounds.nrows() <= max_dense_bits / bounds.ncols()) {
+      solve(moves, [&]() { return dense_visits(bounds); }, length);
+    } else {
+      solve(moves, []() { return sparse_visits(); }, length);
+    }
+    return 0;
   }
 
-  std::cout << "Rope case: number of locations visited by the tail: "
-            << r.visits.size() << std::endl;
+  solve(moves, []() { return hash_visits(); }, length);
 }